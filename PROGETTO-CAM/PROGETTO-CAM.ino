@@ -1,15 +1,284 @@
 #include "esp_camera.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "img_converters.h"
+#include "driver/uart.h"
 #include <WiFi.h>
 #include <HTTPClient.h>
+#include <WiFiClient.h>
+#include <Preferences.h>
+#include "spyhole_core.h"
 
 // Dati rete WiFi
 const char* ssid = "andrea";
 const char* password = "12345678";
 
-// URL del server a cui fare POST
-const char* serverUrl = "http://172.20.10.2:5000/upload";
+// Server di riconoscimento, nell'ordine di preferenza iniziale: poi ogni
+// upload va al piu' veloce e, se tarda, parte un duplicato verso il secondo
+// (spyhole_core.h, CORE_MAX_SERVERS al massimo). /upload e /ping in HTTP,
+// BIN_PORT sul canale binario.
+const char* serverHosts[] = { "172.20.10.2", "172.20.10.3" };
+const uint16_t serverPort = 5000;
+#define SERVER_COUNT (sizeof(serverHosts) / sizeof(serverHosts[0]))
+
+// Riconnessione veloce: BSSID, canale e indirizzi dell'ultima connessione
+// riuscita restano in RTC (riavvii software) e in NVS (spegnimenti). Al boot e
+// dopo una caduta si tenta prima il collegamento diretto con IP statico, senza
+// scansione ne' DHCP; se entro WIFI_FAST_TIMEOUT_MS non riesce si torna alla
+// scansione completa con DHCP, che aggiorna la cache. Il collegamento lo segue
+// netTask: uartTask non aspetta mai il WiFi e nel frattempo gli accessi
+// ricevono subito 'N'. L'IP riusato e' quello dell'ultimo lease: se l'access
+// point lo riassegna, il collegamento diretto fallisce e si rifa' il DHCP.
+#define WIFI_FAST_TIMEOUT_MS 1500
+#define WIFI_SCAN_TIMEOUT_MS 15000      // poi si ricomincia la scansione
+#define WIFI_CACHE_MAGIC 0x57494649     // "WIFI"
+
+typedef struct {
+  uint32_t magic;
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint8_t reserved;
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+  uint32_t checksum;
+} WifiCache;
+
+typedef enum {
+  WIFI_IDLE,
+  WIFI_FAST,                            // collegamento diretto dalla cache
+  WIFI_SCAN,                            // scansione + DHCP
+  WIFI_UP
+} WifiState;
+
+RTC_NOINIT_ATTR WifiCache rtcWifiCache; // sopravvive ai reset software, non allo spegnimento
+WifiCache wifiCache;
+bool wifiCacheValid = false;
+WifiState wifiState = WIFI_IDLE;
+unsigned long wifiStartMs = 0;          // inizio del tentativo in corso
+unsigned long wifiDownMs = 0;           // boot o caduta: base del tempo di recupero
+Preferences prefs;
+
+// Connessione persistente: un socket TCP per server, aperto e tenuto vivo
+// da netTask, riusato da ogni upload (niente handshake a ogni accesso).
+// Con HTTP_KEEPALIVE 0 si torna a una connessione nuova per upload, per confronto.
+// Ping, backoff e timeout del canale binario sono in spyhole_core.h.
+// In HTTP l'upload e' bloccante: niente duplicati, solo il failover sul server
+// successivo dopo HTTP_TIMEOUT_MS.
+#define HTTP_KEEPALIVE 1
+#define HTTP_TIMEOUT_MS 10000
+
+// Upload sul canale binario (protocol.h) invece di HTTP POST: pochi byte di
+// overhead per richiesta, verdetto in un campo fisso invece che cercato nel
+// JSON, e il server puo' inviare configurazione sulla stessa connessione.
+// Con UPLOAD_BINARY 0 si usa /upload via HTTP come prima.
+#define UPLOAD_BINARY 1
+
+HTTPClient http;                        // usato solo da netTask, un upload alla volta
+
+// La latenza trigger -> verdetto dell'ultimo accesso (lastLatencyMs, lastStages)
+// e le misure dell'ultimo upload usate dal controllo adattivo (lastUploadMs,
+// lastServerMs, lastUploadBytes) sono tenute da spyhole_core.
+
+// Controllo adattivo di risoluzione e qualita' JPEG: dopo ogni accesso confronta
+// la latenza trigger -> verdetto (media mobile) con ADAPT_TARGET_MS e sposta il
+// sensore di un gradino lungo adaptLevels. Si scende (meno byte) se si e' lenti o
+// se il segnale WiFi e' debole, si risale se c'e' margine. ADAPT_LOWEST_LEVEL
+// limita la discesa: sotto VGA il volto a un metro ha troppi pochi pixel per il server.
+#define ADAPT_ENABLED 1
+#define ADAPT_TARGET_MS 1200            // valore iniziale, il server puo' cambiarlo (BIN_CFG_ADAPT_TARGET_MS)
+#define ADAPT_HOLD_UPLOADS 3            // accessi minimi tra due cambi (isteresi)
+#define ADAPT_WEAK_RSSI -80             // dBm
+#define ADAPT_LOWEST_LEVEL 3
+
+typedef struct {
+  framesize_t size;
+  uint8_t quality;                      // 0-63, piu' basso = meglio
+  const char *name;
+} AdaptLevel;
+
+const AdaptLevel adaptLevels[] = {
+  { FRAMESIZE_SVGA, 8,  "SVGA/q8"  },
+  { FRAMESIZE_SVGA, 12, "SVGA/q12" },
+  { FRAMESIZE_VGA,  10, "VGA/q10"  },
+  { FRAMESIZE_VGA,  14, "VGA/q14"  },
+  { FRAMESIZE_CIF,  12, "CIF/q12"  },   // configurazione senza PSRAM
+};
+#define ADAPT_LEVEL_COUNT (sizeof(adaptLevels) / sizeof(adaptLevels[0]))
+
+bool adaptEnabled = ADAPT_ENABLED;
+unsigned long adaptTargetMs = ADAPT_TARGET_MS;
+int adaptLevel = 0;
+int adaptTopLevel = 0;                  // il buffer del driver e' dimensionato per questo livello
+int adaptHold = 0;
+unsigned long adaptEwmaMs = 0;
+int64_t adaptChangedUs = 0;             // i frame precedenti hanno il formato vecchio
+// l'ultima decisione va al server con l'upload successivo (adaptLog, in spyhole_core)
 
 #define LED_PIN 4
+
+// Collegamento con lo STM32 su UART0, gestito direttamente con il driver
+// ESP-IDF: il pattern detector segnala ogni '\n' e uartTask resta bloccato
+// sulla coda eventi finche' non arriva un comando completo.
+#define STM32_UART UART_NUM_0
+#define STM32_BAUD 115200
+#define UART_RX_BUF 1024
+#define UART_EVENT_QUEUE 16
+#define UART_CMD_MAX 32                 // "P", "C", "2:<id>"
+
+QueueHandle_t uartQueue;
+char uartCmd[UART_CMD_MAX];
+
+// Warm-up speculativo: lo STM32 invia "P" quando l'utente inizia a scrivere
+// "Access" (o quando scatta il sensore di presenza) e "C" se il comando era un altro.
+// Nel frattempo il sensore continua a produrre frame, cosi' esposizione e
+// bilanciamento del bianco sono gia' assestati quando arriva il trigger "2".
+#define WARMUP_TIMEOUT_MS 5000
+bool warmupActive = false;              // scritto da uartTask sotto flashMux, letto anche da netTask
+unsigned long warmupStart = 0;
+
+// Risparmio energetico tra un accesso e l'altro: dopo POWER_IDLE_MS senza
+// comandi, accessi in corso o warm-up il sensore va in power-down (PWDN, i
+// registri restano) e si rilascia il lock di esp_pm, cosi' il SoC entra in
+// light sleep automatico tra un beacon e l'altro restando associato al WiFi.
+// Lo svegliano i fronti sulla RX dello STM32; i caratteri del risveglio vanno
+// persi, per questo dopo un silenzio lo STM32 fa precedere il comando da righe
+// vuote (CAM_WAKE_* in door.h). "P" e il trigger riaccendono il sensore: con il
+// warm-up questo avviene mentre l'utente scrive e l'accesso non paga nulla.
+// Il tempo risveglio -> primo frame nel ring va al server con l'upload (powerLog).
+#define POWER_SAVE 1
+#define POWER_IDLE_MS 10000             // deve restare sopra CAM_WAKE_IDLE_MS dello STM32
+#define POWER_POLL_MS 1000              // periodo di netTask in standby (ping, configurazione)
+#define POWER_WAKE_EDGES 3              // fronti sulla RX che svegliano il SoC (minimo 3)
+#define POWER_WAKE_MAX_MS FRAME_WAIT_MS // oltre, il trigger non troverebbe un frame: risveglio lento
+
+#if POWER_SAVE
+#include "esp_pm.h"
+#include "esp_sleep.h"
+#include "driver/gpio.h"
+
+esp_pm_lock_handle_t powerLock;         // tenuto mentre il sensore e' attivo: CPU al massimo, niente light sleep
+bool lightSleepOk = false;              // false se il core non ha il tickless idle: solo standby del sensore
+volatile bool sensorStandby = false;
+volatile bool captureParked = false;    // captureTask fermo, il sensore si puo' spegnere
+unsigned long lastCommandMs = 0;
+unsigned long standbyStartMs = 0;
+unsigned long standbyMs = 0;            // durata dell'ultimo standby
+int64_t powerWakeUs = 0;                // risveglio da misurare, 0 = gia' misurato
+unsigned long powerLateWakes = 0;
+#endif
+
+// Pre-roll: captureTask acquisisce di continuo e copia gli ultimi FRAME_RING_SIZE
+// JPEG in PSRAM con il loro timestamp. Al trigger si invia subito il frame piu'
+// recente gia' pronto invece di aspettarne uno nuovo dal sensore.
+#define FRAME_RING_SIZE 4
+#define FRAME_SLOT_BYTES (96 * 1024)    // JPEG SVGA q8 tipico: 30-60 KB
+#define FRAME_WAIT_MS 500               // attesa massima di un frame valido
+
+// Convergenza di esposizione e guadagno: dopo l'accensione del flash, il
+// risveglio del sensore o un cambio di formato, i frame vengono scartati
+// finche' AEC e AGC dell'OV2640 (letti dai registri a ogni frame) non restano
+// entro AE_TOLERANCE_PCT per AE_STABLE_FRAMES frame di fila. Nel ring entrano
+// solo frame esposti a regime, quindi il trigger prende il primo frame buono
+// invece di aspettare un ritardo fisso. Se entro AE_CONVERGE_MAX_MS non si
+// stabilizza (luce che cambia) si tiene comunque il frame. Il tempo di
+// convergenza va al server con l'upload successivo (aeLog).
+#define AE_MIN_FRAMES 2                 // scartati comunque: esposti (in parte) prima del cambio
+#define AE_STABLE_FRAMES 2
+#define AE_TOLERANCE_PCT 5
+#define AE_CONVERGE_MAX_MS 400          // sotto FRAME_WAIT_MS: il trigger trova sempre un frame
+#define AE_FALLBACK_MS 150              // sensore senza registri leggibili: ritardo fisso
+
+SemaphoreHandle_t sensorMutex;          // accessi SCCB (registri AE, cambi di formato)
+volatile uint32_t aeEpoch = 0;          // incrementato a ogni nuova convergenza richiesta
+volatile int64_t aeStartUs = 0;
+// uartTask accende il flash per un trigger mentre netTask, sull'altro core, lo
+// spegne alla fine dell'accesso precedente: contatore, warm-up, LED e inizio
+// della convergenza cambiano insieme sotto questo lock (flashAcquire/flashRelease)
+portMUX_TYPE flashMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Burst: al trigger si considerano gli ultimi BURST_FRAMES frame validi e si
+// carica solo quello con il punteggio migliore (nitidezza della luminanza,
+// penalizzata da sovra/sottoesposizione). Un frame mosso non costa piu' un
+// intero tentativo "Access" all'utente. Con il warm-up attivo i frame sono gia'
+// nel ring; altrimenti si aspetta al massimo BURST_WAIT_MS per completare il burst.
+// BURST_FRAMES deve restare minore di FRAME_RING_SIZE (captureTask ha bisogno di uno slot libero).
+#define BURST_FRAMES 3
+#define BURST_WAIT_MS 250
+#define SCORE_SCALE JPG_SCALE_4X        // il punteggio si calcola su 1/4 della risoluzione
+#define SCORE_DIV 4
+#define HASH_SCALE JPG_SCALE_8X         // l'impronta per la deduplica su 1/8 (100x75 per SVGA)
+#define HASH_DIV 8
+
+typedef struct {
+  uint8_t *buf;
+  size_t len;
+  uint16_t width;
+  uint16_t height;
+  int64_t captureUs;                    // esp_timer_get_time() all'uscita dal sensore
+  uint32_t seq;
+  bool busy;                            // in upload: captureTask non lo sovrascrive
+} FrameSlot;
+
+FrameSlot frameRing[FRAME_RING_SIZE];
+SemaphoreHandle_t ringMutex;
+TaskHandle_t encodeTaskHandle = NULL;   // notificato a ogni nuovo frame
+TaskHandle_t captureTaskHandle = NULL;
+bool ringReady = false;
+uint8_t *scoreBuf = NULL;               // RGB565/luma ridotto per il punteggio del burst
+uint32_t frameSeq = 0;
+// Rilevamento del volto sul dispositivo (modelli esp-dl MSR01+MNP01 inclusi nel
+// core esp32 2.x). Se nel frame non c'e' nessun volto si risponde subito 'N'
+// senza contattare il server; altrimenti si carica solo il ritaglio del volto,
+// ricodificato ad alta qualita', e il server salta la propria detection.
+#define FACE_DETECT_ON_DEVICE 0
+#define FACE_CROP_MARGIN_PCT 30         // margine attorno al box (il server vuole un po' di contesto)
+#define FACE_CROP_QUALITY 90            // qualita' fmt2jpg, 0-100
+#define FACE_CROP_MIN_SIZE 96           // sotto questa dimensione il volto e' troppo lontano
+
+#if FACE_DETECT_ON_DEVICE
+#include "human_face_detect_msr01.hpp"
+#include "human_face_detect_mnp01.hpp"
+
+#define FACE_DETECT_SCALE JPG_SCALE_4X  // detection su 200x150 per un frame SVGA
+#define FACE_DETECT_DIV 4
+
+HumanFaceDetectMSR01 faceStage1(0.1F, 0.5F, 10, 0.2F);
+HumanFaceDetectMNP01 faceStage2(0.5F, 0.3F, 5);
+uint8_t *detectBuf = NULL;              // RGB565 ridotto per la detection
+uint8_t *decodeBuf = NULL;              // RGB565 a piena risoluzione
+uint8_t *cropBuf = NULL;                // RGB565 del ritaglio
+
+// JPEG dei ritagli: uno per ogni job che puo' essere in giro nella pipeline
+// (due in coda, uno in upload, uno in preparazione), niente malloc per accesso
+#define CROP_POOL_SIZE 4
+#define CROP_JPG_BYTES (48 * 1024)
+
+typedef struct {
+  uint8_t *buf;
+  size_t len;
+} CropWriter;
+
+uint8_t *cropJpg[CROP_POOL_SIZE];
+bool cropJpgBusy[CROP_POOL_SIZE];
+#endif
+
+// Pipeline di un accesso: un task per stadio, collegati da code che passano
+// un CoreJob con i soli puntatori ai frame (nessuna copia dei JPEG).
+//   uartTask   (core 1)  comando "2", coreTrigger           -> jobQueue
+//   encodeTask (core 1)  coreCapture: ring, detection/crop  -> uploadQueue
+//   netTask    (core 0)  coreFinish: upload, risposta, rilascio del frame
+// Mentre netTask aspetta il server, encodeTask prepara gia' il trigger successivo
+// (es. l'hedging dello STM32) e uartTask resta libero di ricevere comandi.
+#define PIPELINE_DEPTH 2
+
+QueueHandle_t jobQueue;
+QueueHandle_t uploadQueue;
+int jobsInFlight = 0;                   // trigger non ancora risposti (flash acceso), sotto flashMux
+
+bool flashOn = false;
+int64_t flashOnUs = 0;                  // ultima accensione del LED
 // Setup camera per modulo AI Thinker (modifica se usi altro modello)
 #define PWDN_GPIO_NUM     32
 #define RESET_GPIO_NUM    -1
@@ -58,31 +327,905 @@ void startCamera() {
     //config.jpeg_quality = 10;
     config.jpeg_quality = 8;
     config.fb_count = 2;
+    config.fb_location = CAMERA_FB_IN_PSRAM;
+    config.grab_mode = CAMERA_GRAB_LATEST;  // il driver scarta i frame vecchi
   } else {
     config.frame_size = FRAMESIZE_CIF;
     config.jpeg_quality = 12;
     config.fb_count = 1;
+    adaptTopLevel = adaptLevel = ADAPT_LEVEL_COUNT - 1;
   }
 
   esp_err_t err = esp_camera_init(&config);
   if (err != ESP_OK) {
-    Serial.printf("Camera init failed with error 0x%x\n", err);
+    char msg[48];
+    snprintf(msg, sizeof(msg), "Camera init failed with error 0x%x\n", err);
+    uartPrint(msg);
+  }
+}
+
+// Alloca il ring in PSRAM; senza PSRAM si resta sull'acquisizione al trigger
+bool ringInit() {
+  if (!psramFound()) return false;
+  for (int i = 0; i < FRAME_RING_SIZE; i++) {
+    frameRing[i].buf = (uint8_t *)ps_malloc(FRAME_SLOT_BYTES);
+    if (!frameRing[i].buf) return false;
+    frameRing[i].len = 0;
+    frameRing[i].busy = false;
+  }
+  scoreBuf = (uint8_t *)ps_malloc(800 * 600 * 2 / (SCORE_DIV * SCORE_DIV));
+  ringMutex = xSemaphoreCreateMutex();
+  return scoreBuf != NULL;
+}
+
+// RGB565 (big-endian, come lo scrive jpg2rgb565) -> luma 0..255
+static inline uint32_t rgb565Luma(const uint8_t *p) {
+  uint16_t px = (p[0] << 8) | p[1];
+  return ((px >> 11) * 8 * 77 + ((px >> 5) & 0x3F) * 4 * 150 + (px & 0x1F) * 8 * 29) >> 8;
+}
+
+// Punteggio di un frame: varianza del laplaciano della luminanza (alta = nitido),
+// scalata per la frazione di pixel non saturi e per la distanza della media da
+// 128. 0 se il JPEG non si decodifica.
+uint32_t frameScore(const uint8_t *jpg, size_t len, uint16_t w, uint16_t h) {
+  int sw = w / SCORE_DIV, sh = h / SCORE_DIV;
+  if (sw < 3 || sh < 3 || (size_t)w * h > 800 * 600) return 0;
+  if (!jpg2rgb565(jpg, len, scoreBuf, SCORE_SCALE)) return 0;
+
+  // luma in place sul primo byte di ogni pixel
+  uint32_t sum = 0, clipped = 0;
+  for (int i = 0; i < sw * sh; i++) {
+    uint32_t y = rgb565Luma(scoreBuf + 2 * i);
+    scoreBuf[i] = y;
+    sum += y;
+    if (y < 16 || y > 240) clipped++;
+  }
+
+  int64_t lapSum = 0;
+  uint64_t lapSq = 0;
+  uint32_t n = 0;
+  for (int y = 1; y < sh - 1; y++) {
+    const uint8_t *row = scoreBuf + y * sw;
+    for (int x = 1; x < sw - 1; x++) {
+      int lap = 4 * row[x] - row[x - 1] - row[x + 1] - row[x - sw] - row[x + sw];
+      lapSum += lap;
+      lapSq += lap * lap;
+      n++;
+    }
+  }
+  int64_t lapMean = lapSum / (int64_t)n;
+  uint64_t variance = lapSq / n - (uint64_t)(lapMean * lapMean);
+
+  uint32_t mean = sum / (sw * sh);
+  uint32_t exposure = 256 - min<uint32_t>(255, 2 * (mean > 128 ? mean - 128 : 128 - mean));   // 1..256
+  uint32_t unclipped = 256 - clipped * 256 / (sw * sh);                                      // 0..256
+  return (uint32_t)min<uint64_t>(0xFFFFFFFFULL, variance * exposure * unclipped >> 8);
+}
+
+// Impronta percettiva per la deduplica (dHash a 64 bit): luma media su una
+// griglia di 9x8 celle, un bit per ogni coppia di celle vicine sulla stessa
+// riga (1 se la sinistra e' piu' chiara). Regge ricompressione, rumore e
+// piccole variazioni di esposizione; cambia se qualcuno si muove davanti alla
+// porta. Usa scoreBuf: si chiama da encodeTask, come frameScore. 0 se il JPEG
+// non si decodifica.
+uint64_t frameHash(const uint8_t *jpg, size_t len, uint16_t w, uint16_t h) {
+  int sw = w / HASH_DIV, sh = h / HASH_DIV;
+  if (sw < 9 || sh < 8 || (size_t)w * h > 800 * 600) return 0;
+  if (!jpg2rgb565(jpg, len, scoreBuf, HASH_SCALE)) return 0;
+
+  uint32_t sum[8][9] = {};
+  uint16_t count[8][9] = {};
+  for (int y = 0; y < sh; y++) {
+    for (int x = 0; x < sw; x++) {
+      int r = y * 8 / sh, c = x * 9 / sw;
+      sum[r][c] += rgb565Luma(scoreBuf + 2 * (y * sw + x));
+      count[r][c]++;
+    }
+  }
+  uint64_t hash = 0;
+  for (int r = 0; r < 8; r++) {
+    for (int c = 0; c < 8; c++) {
+      // confronto delle medie senza divisioni: sum[c] / count[c] > sum[c+1] / count[c+1]
+      hash = (hash << 1) | (sum[r][c] * count[r][c + 1] > sum[r][c + 1] * count[r][c]);
+    }
+  }
+  return hash ? hash : 1;               // 0 e' riservato a "non disponibile"
+}
+
+#if FACE_DETECT_ON_DEVICE
+// Buffer allocati una sola volta in PSRAM, dimensionati per il frame SVGA
+bool faceDetectInit() {
+  const size_t full = 800 * 600 * 2;
+  detectBuf = (uint8_t *)ps_malloc(full / (FACE_DETECT_DIV * FACE_DETECT_DIV));
+  decodeBuf = (uint8_t *)ps_malloc(full);
+  cropBuf = (uint8_t *)ps_malloc(full);
+  for (int i = 0; i < CROP_POOL_SIZE; i++) {
+    cropJpg[i] = (uint8_t *)ps_malloc(CROP_JPG_BYTES);
+    if (!cropJpg[i]) return false;
+  }
+  return detectBuf && decodeBuf && cropBuf;
+}
+
+// Uscita di fmt2jpg_cb nel buffer del pool; 0 (= errore) se il ritaglio non ci sta
+size_t cropWrite(void *arg, size_t index, const void *data, size_t len) {
+  CropWriter *w = (CropWriter *)arg;
+  if (!data) return 0;                  // fine del JPEG
+  if (index + len > CROP_JPG_BYTES) return 0;
+  memcpy(w->buf + index, data, len);
+  w->len = index + len;
+  return len;
+}
+
+// Cerca un volto nel JPEG. Ritorna 0 se non c'e', 1 con il ritaglio in out
+// (CROP_JPG_BYTES byte), -1 se qualcosa non va: in quel caso si carica il
+// frame intero come prima.
+int faceCrop(const uint8_t *jpg, size_t len, uint16_t w, uint16_t h, uint8_t *out, size_t *outLen) {
+  if (!detectBuf || (size_t)w * h * 2 > 800 * 600 * 2) return -1;
+
+  int dw = w / FACE_DETECT_DIV, dh = h / FACE_DETECT_DIV;
+  if (!jpg2rgb565(jpg, len, detectBuf, FACE_DETECT_SCALE)) return -1;
+  std::list<dl::detect::result_t> &candidates = faceStage1.infer((uint16_t *)detectBuf, {dh, dw, 3});
+  std::list<dl::detect::result_t> &results = faceStage2.infer((uint16_t *)detectBuf, {dh, dw, 3}, candidates);
+  if (results.empty()) return 0;
+
+  // volto piu' grande, riportato a piena risoluzione con il margine
+  const dl::detect::result_t *best = NULL;
+  int bestArea = 0;
+  for (const dl::detect::result_t &r : results) {
+    int area = (r.box[2] - r.box[0]) * (r.box[3] - r.box[1]);
+    if (area > bestArea) { bestArea = area; best = &r; }
+  }
+  int bw = (best->box[2] - best->box[0]) * FACE_DETECT_DIV;
+  int bh = (best->box[3] - best->box[1]) * FACE_DETECT_DIV;
+  int x0 = max(0, best->box[0] * FACE_DETECT_DIV - bw * FACE_CROP_MARGIN_PCT / 100);
+  int y0 = max(0, best->box[1] * FACE_DETECT_DIV - bh * FACE_CROP_MARGIN_PCT / 100);
+  int x1 = min((int)w, best->box[2] * FACE_DETECT_DIV + bw * FACE_CROP_MARGIN_PCT / 100);
+  int y1 = min((int)h, best->box[3] * FACE_DETECT_DIV + bh * FACE_CROP_MARGIN_PCT / 100);
+  int cw = x1 - x0, ch = y1 - y0;
+  if (cw < FACE_CROP_MIN_SIZE || ch < FACE_CROP_MIN_SIZE) return 0;
+
+  if (!jpg2rgb565(jpg, len, decodeBuf, JPG_SCALE_NONE)) return -1;
+  for (int y = 0; y < ch; y++) {
+    memcpy(cropBuf + (size_t)y * cw * 2, decodeBuf + ((size_t)(y0 + y) * w + x0) * 2, (size_t)cw * 2);
   }
+  CropWriter writer = { out, 0 };
+  if (!fmt2jpg_cb(cropBuf, (size_t)cw * ch * 2, cw, ch, PIXFORMAT_RGB565, FACE_CROP_QUALITY, cropWrite, &writer)) return -1;
+  *outLen = writer.len;
+  return 1;
 }
+#endif
+
+// Nuova convergenza: prima dell'istante da cui i frame sono validi (flashOnUs,
+// adaptChangedUs), cosi' un frame con timestamp successivo la vede gia'.
+// Con flashMux preso.
+static void aeRestartLocked() {
+  aeStartUs = esp_timer_get_time();
+  __atomic_add_fetch(&aeEpoch, 1, __ATOMIC_SEQ_CST);
+}
+
+void aeRestart() {
+  portENTER_CRITICAL(&flashMux);
+  aeRestartLocked();
+  portEXIT_CRITICAL(&flashMux);
+}
+
+// Esposizione (AEC, 16 bit su tre registri) e guadagno AGC x16 dell'OV2640;
+// false se il sensore e' un altro o la lettura fallisce
+bool aeRead(uint32_t *aec, uint32_t *gain) {
+  sensor_t *sensor = esp_camera_sensor_get();
+  if (!sensor || !sensor->get_reg || sensor->id.PID != OV2640_PID) return false;
+  xSemaphoreTake(sensorMutex, portMAX_DELAY);
+  int hi = sensor->get_reg(sensor, 0x145, 0x3F);     // banco sensore, REG45: AEC[15:10]
+  int mid = sensor->get_reg(sensor, 0x110, 0xFF);    // AEC: AEC[9:2]
+  int lo = sensor->get_reg(sensor, 0x104, 0x03);     // REG04: AEC[1:0]
+  int g = sensor->get_reg(sensor, 0x100, 0xFF);      // GAIN
+  xSemaphoreGive(sensorMutex);
+  if (hi < 0 || mid < 0 || lo < 0 || g < 0) return false;
+  *aec = (hi << 10) | (mid << 2) | lo;
+  // GAIN = (bit7+1)(bit6+1)(bit5+1)(bit4+1)(1 + bit[3:0]/16)
+  *gain = ((g >> 7 & 1) + 1) * ((g >> 6 & 1) + 1) * ((g >> 5 & 1) + 1) * ((g >> 4 & 1) + 1) * (16 + (g & 0x0F));
+  return true;
+}
+
+static inline bool aeClose(uint32_t a, uint32_t b) {
+  uint32_t diff = a > b ? a - b : b - a;
+  return diff * 100 <= AE_TOLERANCE_PCT * max(a, b);
+}
+
+// Per ogni frame che esce dal sensore, nell'ordine di acquisizione: true se e'
+// esposto a regime. Lo chiama captureTask (o, senza ring, chi legge il driver).
+bool aeFrameSettled(int64_t captureUs) {
+  static uint32_t epoch = 0, frames = 0, stable = 0, lastAec = 0, lastGain = 0;
+  static bool settled = false;
+  // epoca e istante di inizio della stessa convergenza (64 bit: non atomico)
+  portENTER_CRITICAL(&flashMux);
+  uint32_t current = aeEpoch;
+  int64_t startUs = aeStartUs;
+  portEXIT_CRITICAL(&flashMux);
+
+  if (current != epoch) {
+    epoch = current;
+    frames = stable = 0;
+    settled = false;
+  }
+  if (settled) return true;
+
+  frames++;
+  unsigned long ms = (unsigned long)((captureUs - startUs) / 1000);
+  uint32_t aec = 0, gain = 0;
+  bool steady;
+  if (aeRead(&aec, &gain)) {
+    stable = (frames > 1 && aeClose(aec, lastAec) && aeClose(gain, lastGain)) ? stable + 1 : 0;
+    lastAec = aec;
+    lastGain = gain;
+    steady = frames > AE_MIN_FRAMES && stable >= AE_STABLE_FRAMES;
+  } else {
+    steady = ms >= AE_FALLBACK_MS;
+  }
+  bool timeout = !steady && ms >= AE_CONVERGE_MAX_MS;
+  if (!steady && !timeout) return false;
+
+  settled = true;
+  snprintf(aeLog, sizeof(aeLog), "%lums frames=%lu aec=%lu gain=%lu%s", ms, (unsigned long)frames,
+           (unsigned long)aec, (unsigned long)gain, timeout ? " timeout" : "");
+  return true;
+}
+
+// Con flashMux preso: solo da flashAcquire/flashRelease
+static void setFlash(bool on) {
+  if (on && !flashOn) {
+    aeRestartLocked();                  // cambia la luce: l'AE deve riconvergere
+    flashOnUs = esp_timer_get_time();
+  }
+  flashOn = on;
+  digitalWrite(LED_PIN, on ? HIGH : LOW);
+}
+
+// Acquisizione continua: ogni frame sostituisce lo slot piu' vecchio non in uso
+void captureTask(void * parameter) {
+  while (true) {
+#if POWER_SAVE
+    if (sensorStandby) {
+      captureParked = true;
+      while (sensorStandby) ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      captureParked = false;
+      // il driver conserva l'ultimo frame acquisito prima dello standby
+      camera_fb_t *stale = esp_camera_fb_get();
+      if (stale) esp_camera_fb_return(stale);
+      continue;
+    }
+#endif
+    camera_fb_t * fb = esp_camera_fb_get();
+    if (!fb) {
+      vTaskDelay(10 / portTICK_PERIOD_MS);
+      continue;
+    }
+    int64_t now = esp_timer_get_time();
+
+    // frame ancora in convergenza: non entra nel ring
+    if (fb->format == PIXFORMAT_JPEG && fb->len <= FRAME_SLOT_BYTES && aeFrameSettled(now)) {
+      xSemaphoreTake(ringMutex, portMAX_DELAY);
+      FrameSlot *oldest = NULL;
+      for (int i = 0; i < FRAME_RING_SIZE; i++) {
+        FrameSlot *f = &frameRing[i];
+        if (!f->busy && (!oldest || f->seq < oldest->seq)) oldest = f;
+      }
+      if (oldest) {
+        oldest->busy = true;            // la copia avviene fuori dal mutex
+        xSemaphoreGive(ringMutex);
+        memcpy(oldest->buf, fb->buf, fb->len);
+        xSemaphoreTake(ringMutex, portMAX_DELAY);
+        oldest->len = fb->len;
+        oldest->width = fb->width;
+        oldest->height = fb->height;
+        oldest->captureUs = now;
+        oldest->seq = ++frameSeq;
+        oldest->busy = false;
+      }
+      xSemaphoreGive(ringMutex);
+      if (encodeTaskHandle) xTaskNotifyGive(encodeTaskHandle);
+#if POWER_SAVE
+      powerFrameSeen(now);
+#endif
+    }
+    esp_camera_fb_return(fb);
+  }
+}
+
+// Restituisce (bloccato) il frame migliore tra gli ultimi BURST_FRAMES acquisiti
+// dopo sinceUs. Aspetta il burst completo al massimo BURST_WAIT_MS, poi si
+// accontenta dei frame presenti; NULL se entro FRAME_WAIT_MS non ne arriva nessuno.
+FrameSlot *ringAcquire(int64_t sinceUs) {
+  FrameSlot *burst[BURST_FRAMES];
+  int n = 0;
+  unsigned long start = millis();
+
+  while (true) {
+    unsigned long waited = millis() - start;
+    xSemaphoreTake(ringMutex, portMAX_DELAY);
+    int valid = 0;
+    for (int i = 0; i < FRAME_RING_SIZE; i++) {
+      FrameSlot *f = &frameRing[i];
+      if (!f->busy && f->len && f->captureUs >= sinceUs) valid++;
+    }
+    if (valid >= BURST_FRAMES || (valid > 0 && waited >= BURST_WAIT_MS)) {
+      // i BURST_FRAMES piu' recenti, in ordine di sequenza decrescente
+      while (n < BURST_FRAMES) {
+        FrameSlot *newest = NULL;
+        for (int i = 0; i < FRAME_RING_SIZE; i++) {
+          FrameSlot *f = &frameRing[i];
+          if (f->busy || !f->len || f->captureUs < sinceUs) continue;
+          if (!newest || f->seq > newest->seq) newest = f;
+        }
+        if (!newest) break;
+        newest->busy = true;
+        burst[n++] = newest;
+      }
+    }
+    xSemaphoreGive(ringMutex);
+
+    if (n > 0) break;
+    if (waited >= FRAME_WAIT_MS) return NULL;
+    ulTaskNotifyTake(pdTRUE, (FRAME_WAIT_MS - waited) / portTICK_PERIOD_MS);
+  }
+
+  int best = 0;
+  if (n > 1) {
+    uint32_t bestScore = 0;
+    for (int i = 0; i < n; i++) {
+      uint32_t score = frameScore(burst[i]->buf, burst[i]->len, burst[i]->width, burst[i]->height);
+      if (score > bestScore) {
+        bestScore = score;
+        best = i;
+      }
+    }
+  }
+  for (int i = 0; i < n; i++) {
+    if (i != best) ringRelease(burst[i]);
+  }
+  return burst[best];
+}
+
+void ringRelease(FrameSlot *f) {
+  xSemaphoreTake(ringMutex, portMAX_DELAY);
+  f->busy = false;
+  xSemaphoreGive(ringMutex);
+}
+
+void uartInit() {
+  uart_config_t cfg = {};
+  cfg.baud_rate = STM32_BAUD;
+  cfg.data_bits = UART_DATA_8_BITS;
+  cfg.parity = UART_PARITY_DISABLE;
+  cfg.stop_bits = UART_STOP_BITS_1;
+  cfg.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+  cfg.source_clk = UART_SCLK_APB;
+
+  uart_driver_install(STM32_UART, UART_RX_BUF, 0, UART_EVENT_QUEUE, &uartQueue, 0);
+  uart_param_config(STM32_UART, &cfg);
+  uart_set_pin(STM32_UART, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+  uart_enable_pattern_det_baud_intr(STM32_UART, '\n', 1, 9, 0, 0);
+  uart_pattern_queue_reset(STM32_UART, UART_EVENT_QUEUE);
+}
+
+void uartPrint(const char *msg) {
+  uart_write_bytes(STM32_UART, msg, strlen(msg));
+}
+
+// Un passo del controllo adattivo, dopo ogni upload (fuori dal percorso critico)
+void adaptUpdate(unsigned long latencyMs) {
+  adaptEwmaMs = adaptEwmaMs ? (adaptEwmaMs * 3 + latencyMs) / 4 : latencyMs;
+  if (!adaptEnabled || ++adaptHold < ADAPT_HOLD_UPLOADS) return;
+
+  int8_t rssi = WiFi.RSSI();
+  int lowest = max(adaptTopLevel, min(ADAPT_LOWEST_LEVEL, (int)ADAPT_LEVEL_COUNT - 1));
+  int next = adaptLevel;
+  const char *reason = NULL;
+
+  if ((adaptEwmaMs > adaptTargetMs * 11 / 10 || rssi < ADAPT_WEAK_RSSI) && adaptLevel < lowest) {
+    next = adaptLevel + 1;
+    reason = (rssi < ADAPT_WEAK_RSSI) ? "weak-rssi" : "slow";
+  } else if (adaptEwmaMs < adaptTargetMs * 7 / 10 && rssi >= ADAPT_WEAK_RSSI && adaptLevel > adaptTopLevel) {
+    next = adaptLevel - 1;
+    reason = "headroom";
+  }
+  if (next == adaptLevel) return;
+
+  sensor_t *sensor = esp_camera_sensor_get();
+  if (!sensor) return;
+  xSemaphoreTake(sensorMutex, portMAX_DELAY);
+  if (adaptLevels[next].size != adaptLevels[adaptLevel].size) sensor->set_framesize(sensor, adaptLevels[next].size);
+  sensor->set_quality(sensor, adaptLevels[next].quality);
+  xSemaphoreGive(sensorMutex);
+  portENTER_CRITICAL(&flashMux);
+  aeRestartLocked();
+  adaptChangedUs = esp_timer_get_time();
+  portEXIT_CRITICAL(&flashMux);
+
+  unsigned long netMs = lastUploadMs > lastServerMs ? lastUploadMs - lastServerMs : 1;
+  snprintf(adaptLog, sizeof(adaptLog), "%s->%s %s ewma=%lums rssi=%d bytes=%u net=%lums srv=%lums %lukB/s",
+           adaptLevels[adaptLevel].name, adaptLevels[next].name, reason, adaptEwmaMs, rssi,
+           (unsigned)lastUploadBytes, netMs, lastServerMs, (unsigned long)(lastUploadBytes / netMs));
+  adaptLevel = next;
+  adaptHold = 0;
+}
+
+// Accende il flash per un trigger (job) o per il warm-up. Ritorna l'istante da
+// cui i frame sono validi: accensione del flash o ultimo cambio di formato.
+int64_t flashAcquire(bool job) {
+  portENTER_CRITICAL(&flashMux);
+  if (job) {
+    warmupActive = false;               // il trigger consuma il warm-up
+    jobsInFlight++;
+  } else {
+    warmupActive = true;
+  }
+  setFlash(true);
+  int64_t validUs = max(flashOnUs, adaptChangedUs);
+  portEXIT_CRITICAL(&flashMux);
+  return validUs;
+}
+
+// Fine di un accesso (job) o del warm-up: spegne il flash solo se nessun altro
+// ne ha ancora bisogno. Decremento, controllo e LED nello stesso lock, cosi'
+// uno spegnimento deciso qui non puo' seguire l'accensione per un nuovo trigger.
+void flashRelease(bool job) {
+  portENTER_CRITICAL(&flashMux);
+  if (job) jobsInFlight--;
+  else warmupActive = false;
+  if (!warmupActive && jobsInFlight == 0) setFlash(false);
+  portEXIT_CRITICAL(&flashMux);
+}
+
+#if POWER_SAVE
+// Light sleep automatico: il SoC dorme quando tutti i task sono bloccati e
+// nessuno tiene un lock. La frequenza minima resta 80 MHz perche' l'APB non
+// cambi: baud della UART e XCLK della camera ne dipendono.
+void powerInit() {
+  esp_pm_config_esp32_t pm = {};
+  pm.max_freq_mhz = 240;
+  pm.min_freq_mhz = 80;
+  pm.light_sleep_enable = true;
+  lightSleepOk = esp_pm_configure(&pm) == ESP_OK;
+  if (!lightSleepOk) {
+    pm.light_sleep_enable = false;      // core senza tickless idle: solo scalatura della frequenza
+    esp_pm_configure(&pm);
+  }
+  esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "camera", &powerLock);
+  esp_pm_lock_acquire(powerLock);
+  uart_set_wakeup_threshold(STM32_UART, POWER_WAKE_EDGES);
+  esp_sleep_enable_uart_wakeup(STM32_UART);
+  lastCommandMs = millis();
+}
+
+// Sensore in power-down e lock rilasciato; da uartTask, a flash spento
+void powerStandby() {
+  sensorStandby = true;
+  // captureTask finisce il frame in corso e si ferma prima che il sensore smetta di produrne
+  for (int i = 0; ringReady && !captureParked && i < 50; i++) vTaskDelay(10 / portTICK_PERIOD_MS);
+  gpio_set_level((gpio_num_t)PWDN_GPIO_NUM, 1);
+  standbyStartMs = millis();
+  esp_pm_lock_release(powerLock);
+}
+
+// "P" o trigger dopo lo standby: il SoC e' gia' sveglio, si riaccende il sensore
+void powerWake() {
+  if (!sensorStandby) return;
+  esp_pm_lock_acquire(powerLock);
+  gpio_set_level((gpio_num_t)PWDN_GPIO_NUM, 0);
+  standbyMs = millis() - standbyStartMs;
+  aeRestart();
+  powerWakeUs = esp_timer_get_time();
+  sensorStandby = false;
+  if (captureTaskHandle) xTaskNotifyGive(captureTaskHandle);
+}
+
+// Primo frame nel ring dopo il risveglio: chiude la misura
+void powerFrameSeen(int64_t captureUs) {
+  int64_t wakeUs = powerWakeUs;
+  if (!wakeUs || captureUs < wakeUs) return;
+  powerWakeUs = 0;
+  unsigned long ms = (unsigned long)((captureUs - wakeUs) / 1000);
+  if (ms > POWER_WAKE_MAX_MS) powerLateWakes++;
+  snprintf(powerLog, sizeof(powerLog), "wake=%lums standby=%lus late=%lu sleep=%d", ms, standbyMs / 1000,
+           powerLateWakes, lightSleepOk);
+}
+#endif
+
+uint32_t wifiCacheChecksum(const WifiCache *c) {
+  const uint8_t *p = (const uint8_t *)c;
+  uint32_t h = 2166136261u;             // FNV-1a su tutto tranne il checksum
+  for (size_t i = 0; i < offsetof(WifiCache, checksum); i++) h = (h ^ p[i]) * 16777619u;
+  return h;
+}
+
+bool wifiCacheCheck(const WifiCache *c) {
+  return c->magic == WIFI_CACHE_MAGIC && c->checksum == wifiCacheChecksum(c);
+}
+
+// Cache dalla RTC (riavvio software) o, dopo uno spegnimento, dalla NVS
+void wifiCacheLoad() {
+  if (wifiCacheCheck(&rtcWifiCache)) {
+    wifiCache = rtcWifiCache;
+    wifiCacheValid = true;
+    return;
+  }
+  prefs.begin("wifi", true);
+  wifiCacheValid = prefs.getBytes("cache", &wifiCache, sizeof(wifiCache)) == sizeof(wifiCache) && wifiCacheCheck(&wifiCache);
+  prefs.end();
+  if (wifiCacheValid) rtcWifiCache = wifiCache;
+}
+
+// Salva la connessione appena riuscita; la NVS si scrive solo se qualcosa e' cambiato
+void wifiCacheStore() {
+  WifiCache c = {};
+  c.magic = WIFI_CACHE_MAGIC;
+  const uint8_t *bssid = WiFi.BSSID();
+  if (bssid) memcpy(c.bssid, bssid, sizeof(c.bssid));
+  c.channel = WiFi.channel();
+  c.ip = WiFi.localIP();
+  c.gateway = WiFi.gatewayIP();
+  c.subnet = WiFi.subnetMask();
+  c.dns = WiFi.dnsIP();
+  c.checksum = wifiCacheChecksum(&c);
+
+  rtcWifiCache = c;
+  if (wifiCacheValid && memcmp(&c, &wifiCache, sizeof(c)) == 0) return;
+  wifiCache = c;
+  wifiCacheValid = true;
+  prefs.begin("wifi", false);
+  prefs.putBytes("cache", &c, sizeof(c));
+  prefs.end();
+}
+
+void wifiBegin(bool fast) {
+  WiFi.disconnect();
+  if (fast) {
+    WiFi.config(IPAddress(wifiCache.ip), IPAddress(wifiCache.gateway), IPAddress(wifiCache.subnet), IPAddress(wifiCache.dns));
+    WiFi.begin(ssid, password, wifiCache.channel, wifiCache.bssid);
+  } else {
+    IPAddress none((uint32_t)0);        // tutto a zero = di nuovo DHCP
+    WiFi.config(none, none, none);
+    WiFi.begin(ssid, password);
+  }
+  wifiState = fast ? WIFI_FAST : WIFI_SCAN;
+  wifiStartMs = millis();
+}
+
+// Macchina a stati del collegamento, chiamata da netTask tra un upload e l'altro
+void wifiMaintain() {
+  bool up = WiFi.status() == WL_CONNECTED;
+  unsigned long now = millis();
+
+  switch (wifiState) {
+    case WIFI_UP:
+      if (up) return;
+      wifiDownMs = now;                 // caduta: si riparte dal collegamento diretto
+      wifiBegin(wifiCacheValid);
+      return;
+    case WIFI_IDLE:
+      wifiBegin(wifiCacheValid);
+      return;
+    case WIFI_FAST:
+    case WIFI_SCAN:
+      if (up) {
+        snprintf(wifiLog, sizeof(wifiLog), "%s %lums rssi=%d", wifiState == WIFI_FAST ? "fast" : "scan",
+                 now - wifiDownMs, WiFi.RSSI());
+        wifiCacheStore();
+        wifiState = WIFI_UP;
+      } else if (now - wifiStartMs >= (wifiState == WIFI_FAST ? WIFI_FAST_TIMEOUT_MS : WIFI_SCAN_TIMEOUT_MS)) {
+        wifiBegin(false);
+      }
+      return;
+  }
+}
+
+int64_t coreNowUs() {
+  return esp_timer_get_time();
+}
+
+void coreIdle() {
+  vTaskDelay(1);
+}
+
+// Watermark dell'heap interno (quello che si frammenta, la PSRAM ha solo buffer fissi)
+void coreHeapStats(CoreHeap *heap) {
+  heap->freeBytes = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+  heap->minFree = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+  heap->largestBlock = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL);
+}
+
+// Configurazione inviata dal server sul canale binario
+void coreConfigChanged(uint8_t key, uint16_t value) {
+  switch (key) {
+    case BIN_CFG_ADAPT_TARGET_MS:
+      adaptTargetMs = value;
+      break;
+    case BIN_CFG_ADAPT_ENABLED:
+      adaptEnabled = value != 0;
+      break;
+  }
+}
+
+// Legge l'inizio del corpo della risposta in un buffer statico (niente
+// getString()); il resto lo scarta http.end()
+size_t readHttpBody(char *out, size_t size) {
+  WiFiClient *stream = http.getStreamPtr();
+  int expected = http.getSize();        // -1 se il server non manda Content-Length
+  size_t want = (expected >= 0 && (size_t)expected < size) ? expected : size - 1;
+  size_t got = 0;
+  unsigned long start = coreNowMs();
+
+  while (stream && got < want && coreNowMs() - start < HTTP_TIMEOUT_MS) {
+    int n = stream->available() ? stream->read((uint8_t *)out + got, want - got) : 0;
+    if (n > 0) {
+      got += n;
+    } else if (!stream->connected()) {
+      break;
+    } else {
+      vTaskDelay(1);
+    }
+  }
+  out[got] = '\0';
+  return got;
+}
+
+// Un tentativo di upload via HTTP POST: verdetto 'Y'/'N' (BIN_VERDICT_RESEND se il
+// server non ha piu' il risultato di un riferimento), 0 se la richiesta e' fallita.
+// I valori degli header passano da buffer statici; restano solo le String
+// interne di HTTPClient (URL, header), per questo il default e' il canale binario.
+char uploadHttp(WiFiClient *client, const char *url, const uint8_t *buf, size_t len, uint8_t flags, StageTimes *t) {
+  static char httpBody[96];             // {"status": "not ok", ...}: basta l'inizio
+  static char httpValue[40];
+  char verdict = 0;
+  CoreHeap heap;
+
+  http.begin(*client, url);
+  http.addHeader("Content-Type", "image/jpeg");
+  snprintf(httpValue, sizeof(httpValue), "%08lx", (unsigned long)deviceId);
+  http.addHeader("X-Device-Id", httpValue);   // lo stesso ID del canale binario
+  if (flags & BIN_FLAG_FACE_CROP) http.addHeader("X-Face-Crop", "1");
+  if (flags & BIN_FLAG_REPEAT) http.addHeader("X-Repeat", "1");   // corpo vuoto
+  if (lastLatencyMs) {
+    snprintf(httpValue, sizeof(httpValue), "%lu", lastLatencyMs);
+    http.addHeader("X-Prev-Latency-Ms", httpValue);
+    http.addHeader("X-Prev-Reused", lastReused ? "1" : "0");
+  }
+  if (lastStages[0]) http.addHeader("X-Prev-Stages", lastStages);
+  if (adaptLog[0]) http.addHeader("X-Adapt", adaptLog);
+  if (wifiLog[0]) http.addHeader("X-Wifi", wifiLog);
+  if (powerLog[0]) http.addHeader("X-Power", powerLog);
+  if (aeLog[0]) http.addHeader("X-AE", aeLog);
+  if (hedgeLog[0]) http.addHeader("X-Hedge", hedgeLog);
+  coreHeapStats(&heap);
+  snprintf(httpValue, sizeof(httpValue), "%lu/%lu/%lu", (unsigned long)heap.freeBytes,
+           (unsigned long)heap.minFree, (unsigned long)heap.largestBlock);
+  http.addHeader("X-Heap", httpValue);
+
+  unsigned long postStart = coreNowMs();
+  int httpResponseCode = http.POST((uint8_t *)buf, len);
+  if (httpResponseCode > 0) {
+    readHttpBody(httpBody, sizeof(httpBody));
+    lastUploadMs = coreNowMs() - postStart;
+    lastServerMs = http.header("X-Server-Time-Ms").toInt();
+    lastUploadBytes = len;
+    // POST() invia e attende insieme: la fine dell'invio si stima dal tempo del server
+    t->response = coreNowUs();
+    t->sent = max(t->connect, t->response - (int64_t)lastServerMs * 1000);
+    adaptLog[0] = '\0';
+    wifiLog[0] = '\0';
+    powerLog[0] = '\0';
+    aeLog[0] = '\0';
+    hedgeLog[0] = '\0';
+    //[DEBUG]uartPrint(httpBody);
+    if (httpResponseCode == 409) {
+      verdict = BIN_VERDICT_RESEND;
+    } else {
+      verdict = strstr(httpBody, "not ok") ? 'N' : 'Y';
+    }
+  }
+  //[DEBUG]else Serial.printf("Errore invio POST: %d\n", httpResponseCode);
+  http.end();
+  return verdict;
+}
+
+// Porte di spyhole_core verso l'hardware della scheda
+
+class WiFiSocket : public Socket {
+public:
+  explicit WiFiSocket(WiFiClient *client) : client(client), host(NULL), port(0) {}
+  bool connect() { return host && WiFi.status() == WL_CONNECTED && client->connect(host, port); }
+  bool connected() { return client->connected(); }
+  size_t write(const uint8_t *buf, size_t len) { return client->write(buf, len); }
+  int available() { return client->available(); }
+  int read(uint8_t *buf, size_t len) { return client->read(buf, len); }
+  void stop() { client->stop(); }
+
+  WiFiClient *client;
+  const char *host;
+  uint16_t port;
+};
+
+// /upload e /ping sul server Flask (UPLOAD_BINARY 0). HTTPClient riusa il
+// WiFiClient del server se coreUpload l'ha gia' connesso.
+class HttpTransport : public Transport {
+public:
+  explicit HttpTransport(WiFiSocket *socket) : Transport(socket), client(socket->client), url(NULL), pingUrl(NULL) {}
+
+  char send(const uint8_t *buf, size_t len, uint8_t flags, StageTimes *t) {
+    return uploadHttp(client, url, buf, len, flags, t);
+  }
+
+  void keepAlive() {
+    if (coreNowMs() - lastActivity < PING_INTERVAL_MS) return;
+    http.begin(*client, pingUrl);
+    if (http.GET() > 0) {
+      http.getString();
+    } else {
+      socket->stop();                   // riconnessione al prossimo giro
+    }
+    http.end();
+    lastActivity = coreNowMs();
+  }
+
+  bool persistent() { return HTTP_KEEPALIVE; }
+
+  WiFiClient *client;
+  const char *url;
+  const char *pingUrl;
+};
+
+// Un server di serverHosts: connessione, protocollo e indirizzi, registrato
+// in spyhole_core da begin()
+struct NetServer {
+  WiFiClient client;
+  WiFiSocket socket;
+#if UPLOAD_BINARY
+  BinaryTransport transport;
+#else
+  HttpTransport transport;
+#endif
+  char name[24];
+#if !UPLOAD_BINARY
+  char url[48];
+  char pingUrl[48];
+#endif
+
+  NetServer() : socket(&client), transport(&socket) {}
+
+  void begin(const char *host) {
+    socket.host = host;
+    socket.port = UPLOAD_BINARY ? BIN_PORT : serverPort;
+    snprintf(name, sizeof(name), "%s:%u", host, socket.port);
+#if !UPLOAD_BINARY
+    snprintf(url, sizeof(url), "http://%s:%u/upload", host, serverPort);
+    snprintf(pingUrl, sizeof(pingUrl), "http://%s:%u/ping", host, serverPort);
+    transport.url = url;
+    transport.pingUrl = pingUrl;
+#endif
+    coreAddServer(&transport, name);
+  }
+};
+
+class UartSerial : public SerialPort {
+public:
+  void write(const char *buf, size_t len) { uart_write_bytes(STM32_UART, buf, len); }
+};
+
+// Frame dal ring in PSRAM o, senza PSRAM, direttamente dal driver
+class BoardCamera : public CameraPort {
+public:
+  bool acquire(int64_t sinceUs, CoreFrame *frame) {
+    if (ringReady) {
+      FrameSlot *slot = ringAcquire(sinceUs);
+      if (!slot) return false;
+      frame->buf = slot->buf;
+      frame->len = slot->len;
+      frame->width = slot->width;
+      frame->height = slot->height;
+      frame->handle = slot;
+      return true;
+    }
+    camera_fb_t *fb;
+    while ((fb = esp_camera_fb_get()) && !aeFrameSettled(esp_timer_get_time())) esp_camera_fb_return(fb);
+    if (!fb) return false;
+    if (fb->format != PIXFORMAT_JPEG) {
+      esp_camera_fb_return(fb);
+      return false;
+    }
+    frame->buf = fb->buf;
+    frame->len = fb->len;
+    frame->width = fb->width;
+    frame->height = fb->height;
+    frame->handle = fb;
+    return true;
+  }
+
+  void release(CoreFrame *frame) {
+    if (ringReady) {
+      ringRelease((FrameSlot *)frame->handle);
+    } else {
+      esp_camera_fb_return((camera_fb_t *)frame->handle);
+    }
+  }
+
+  // senza PSRAM non c'e' scoreBuf: niente deduplica
+  uint64_t fingerprint(const CoreFrame *frame) {
+    return ringReady ? frameHash(frame->buf, frame->len, frame->width, frame->height) : 0;
+  }
+
+#if FACE_DETECT_ON_DEVICE
+  // Detection locale: decide 'N' senza rete oppure sostituisce il frame con il ritaglio del volto
+  void prepare(CoreJob *job) {
+    int slot = 0;
+    while (slot < CROP_POOL_SIZE && __atomic_test_and_set(&cropJpgBusy[slot], __ATOMIC_SEQ_CST)) slot++;
+    if (slot == CROP_POOL_SIZE || !cropJpg[slot]) {
+      if (slot < CROP_POOL_SIZE) __atomic_clear(&cropJpgBusy[slot], __ATOMIC_SEQ_CST);
+      return;                           // si carica il frame intero
+    }
+
+    size_t cropLen = 0;
+    int found = faceCrop(job->buf, job->len, job->frame.width, job->frame.height, cropJpg[slot], &cropLen);
+    if (found == 1) {
+      job->buf = cropJpg[slot];
+      job->len = cropLen;
+      job->flags |= BIN_FLAG_FACE_CROP;
+      return;                           // lo slot torna libero in cleanup()
+    }
+    if (found == 0) job->verdict = 'N'; // nessuno davanti alla porta
+    __atomic_clear(&cropJpgBusy[slot], __ATOMIC_SEQ_CST);
+  }
+
+  void cleanup(CoreJob *job) {
+    if (!(job->flags & BIN_FLAG_FACE_CROP)) return;
+    for (int i = 0; i < CROP_POOL_SIZE; i++) {
+      if (job->buf == cropJpg[i]) __atomic_clear(&cropJpgBusy[i], __ATOMIC_SEQ_CST);
+    }
+  }
+#endif
+};
+
+NetServer netServers[SERVER_COUNT];      // usati solo da netTask
+UartSerial stm32Serial;
+BoardCamera boardCamera;
 
 void setup() {
-  Serial.begin(115200);
-  delay(1000);
+  uartInit();
   pinMode(LED_PIN, OUTPUT);  // <<== Imposta il pin del LED come uscita
-  WiFi.begin(ssid, password);
-  Serial.print("Connessione WiFi...");
-  while (WiFi.status() != WL_CONNECTED) {
-    delay(500);
-    Serial.print(".");
-  }
-  Serial.println(" connesso!");
+  // il collegamento parte da netTask (wifiMaintain), qui non si aspetta
+  WiFi.persistent(false);               // la configurazione la gestisce wifiCache, niente scritture in flash a ogni begin
+  WiFi.setAutoReconnect(false);
+  WiFi.mode(WIFI_STA);
+  wifiCacheLoad();
+  deviceId = (uint32_t)ESP.getEfuseMac();
 
+  sensorMutex = xSemaphoreCreateMutex();
   startCamera();
+  aeRestart();
+  ringReady = ringInit();
+#if FACE_DETECT_ON_DEVICE
+  faceDetectInit();
+#endif
+#if POWER_SAVE
+  powerInit();
+#endif
+
+  jobQueue = xQueueCreate(PIPELINE_DEPTH, sizeof(CoreJob));
+  uploadQueue = xQueueCreate(PIPELINE_DEPTH, sizeof(CoreJob));
+  static const char *responseHeaders[] = { "X-Server-Time-Ms" };
+  http.collectHeaders(responseHeaders, 1);
+  http.setReuse(HTTP_KEEPALIVE);
+  http.setTimeout(HTTP_TIMEOUT_MS);
+  for (size_t i = 0; i < SERVER_COUNT; i++) netServers[i].begin(serverHosts[i]);
+  xTaskCreatePinnedToCore(
+  netTask,        // funzione
+  "Net Task",     // nome task
+  4096,           // stack size
+  NULL,           // parametri
+  1,              // priorità
+  NULL,           // handle
+  0               // core Pro, insieme allo stack WiFi
+);
   xTaskCreatePinnedToCore(
   uartTask,       // funzione
   "UART Task",    // nome task
@@ -92,60 +1235,180 @@ void setup() {
   NULL,           // handle
   1               // core (1 = core App, 0 = core Pro)
 );
+  xTaskCreatePinnedToCore(encodeTask, "Encode Task", 8192, NULL, 1, &encodeTaskHandle, 1);
+  if (ringReady) {
+    xTaskCreatePinnedToCore(captureTask, "Capture Task", 4096, NULL, 1, &captureTaskHandle, 0);
+  }
 
 }
 
-void uartTask(void * parameter) {
-  Serial.setTimeout(100);  // importante: timeout breve per non bloccare
+// Ultimo stadio della pipeline: coreFinish carica il frame (se serve), risponde
+// allo STM32 e restituisce il buffer al ring o al driver
+void finishJob(CoreJob *job) {
+  bool uploaded = job->verdict == 0;
+  coreFinish(job, &boardCamera, &stm32Serial);
+  flashRelease(true);
+  if (uploaded) adaptUpdate(lastLatencyMs);
+}
+
+// Upload dei frame preparati da encodeTask e, tra un upload e l'altro, cura
+// delle connessioni persistenti (coreMaintain: riconnessione con backoff,
+// ping durante l'inattivita', configurazione inviata dal server)
+void netTask(void * parameter) {
+  CoreJob job;
+
+  while (true) {
+    unsigned long waitMs = 100;
+#if POWER_SAVE
+    if (sensorStandby && wifiState == WIFI_UP) waitMs = POWER_POLL_MS;   // non sveglia il SoC ogni 100 ms
+#endif
+    if (xQueueReceive(uploadQueue, &job, waitMs / portTICK_PERIOD_MS)) {
+      finishJob(&job);
+      continue;
+    }
+    wifiMaintain();
+    coreMaintain();
+  }
+}
+
+// Secondo stadio: per ogni trigger prende il frame e lo prepara per netTask
+void encodeTask(void * parameter) {
+  CoreJob job;
+
   while (true) {
-    if (Serial.available()) {
-      String command = Serial.readStringUntil('\n');
-      command.trim();
+    xQueueReceive(jobQueue, &job, portMAX_DELAY);
+    coreCapture(&boardCamera, &job);
+    xQueueSend(uploadQueue, &job, portMAX_DELAY);
+  }
+}
 
-      if (command == "2") {
-        //[DEBUG]Serial.println("Scatto foto...");
-        digitalWrite(LED_PIN, HIGH);
+// Trigger "2[:<id>]": accende il flash e passa la richiesta alla pipeline.
+// La risposta "<Y|N><id>" la invia netTask.
+void handleTrigger(char requestId) {
+  CoreJob job;
 
-        camera_fb_t * fb = esp_camera_fb_get();
-        if (!fb || fb->format != PIXFORMAT_JPEG) {
-          //[DEBUG]Serial.println("Errore acquisizione!");
-          if (fb) esp_camera_fb_return(fb);
-          digitalWrite(LED_PIN, LOW);
-          continue;
-        }
+  int64_t validUs = flashAcquire(true);
 
-        HTTPClient http;
-        http.setTimeout(10000);
-        http.begin(serverUrl);
-        http.addHeader("Content-Type", "image/jpeg");
-
-        int httpResponseCode = http.POST(fb->buf, fb->len);
-        if (httpResponseCode > 0) {
-          String response = http.getString();
-          //[DEBUG]Serial.println("Server risponde: " + response);
-          if (response.indexOf("not ok") ==-1){
-            Serial.write('Y');
-          }
-          else{
-          Serial.write('N');
-          }
-        } else {
-          //[DEBUG]Serial.printf("Errore invio POST: %d\n", httpResponseCode);
-          Serial.write('N');
-        }
+  // esposto con il flash gia' acceso e con l'ultimo formato scelto dal controllo adattivo
+  // i frame nel ring sono gia' a regime: basta che siano successivi al cambio
+  coreTrigger(&job, requestId, validUs);
+  if (xQueueSend(jobQueue, &job, 0) != pdPASS) {
+    // pipeline piena: meglio un 'N' subito che una risposta dopo la deadline
+    coreReply(&stm32Serial, 'N', requestId);
+    flashRelease(true);
+  }
+}
+
+void handleCommand(char *command) {
+  char requestId = 0;
+  CoreCommand cmd = coreParseCommand(command, &requestId);
+
+#if POWER_SAVE
+  if (cmd != CMD_NONE) lastCommandMs = millis();
+  if (cmd == CMD_PREPARE || cmd == CMD_TRIGGER) powerWake();
+#endif
+  switch (cmd) {
+    case CMD_PREPARE:
+      flashAcquire(false);  // l'AE converge gia' con il flash acceso
+      warmupStart = millis();
+      break;
+    case CMD_CANCEL:
+      flashRelease(false);
+      break;
+    case CMD_TRIGGER:
+      handleTrigger(requestId);
+      break;
+    default:
+      break;
+  }
+}
+
+// Legge dal buffer del driver la riga terminata da '\n' segnalata dal pattern
+// detector. Righe piu' lunghe di UART_CMD_MAX vengono scartate.
+void readCommandLine() {
+  int pos = uart_pattern_pop_pos(STM32_UART);
+  if (pos < 0) {
+    // coda delle posizioni piena: si riparte da zero
+    uart_flush_input(STM32_UART);
+    xQueueReset(uartQueue);
+    return;
+  }
+  if (pos >= UART_CMD_MAX) {
+    uint8_t discard[32];
+    int left = pos + 1;
+    while (left > 0) {
+      int got = uart_read_bytes(STM32_UART, discard, min(left, (int)sizeof(discard)), 0);
+      if (got <= 0) break;              // errore o buffer gia' svuotato (uart_flush_input)
+      left -= got;
+    }
+    return;
+  }
+  int len = uart_read_bytes(STM32_UART, (uint8_t *)uartCmd, pos + 1, 0);   // comando + '\n'
+  if (len <= 0) return;
+  uartCmd[len - 1] = '\0';
+  handleCommand(uartCmd);
+}
+
+void uartTask(void * parameter) {
+  uart_event_t event;
+
+  while (true) {
+    // si blocca fino al prossimo evento; durante il warm-up si sveglia allo scadere
+    TickType_t wait = portMAX_DELAY;
+    if (warmupActive) {
+      unsigned long elapsed = millis() - warmupStart;
+      wait = (elapsed >= WARMUP_TIMEOUT_MS) ? 0 : (WARMUP_TIMEOUT_MS - elapsed) / portTICK_PERIOD_MS;
+      if (!ringReady) wait = 0;         // senza ring il warm-up scarta frame da qui
+    }
+#if POWER_SAVE
+    else if (!sensorStandby) {
+      unsigned long idle = millis() - lastCommandMs;
+      wait = (idle >= POWER_IDLE_MS) ? 0 : (POWER_IDLE_MS - idle) / portTICK_PERIOD_MS;
+    }
+#endif
 
-        http.end();
-        esp_camera_fb_return(fb);
-        digitalWrite(LED_PIN, LOW);
+    if (xQueueReceive(uartQueue, &event, wait)) {
+      switch (event.type) {
+        case UART_PATTERN_DET:
+          readCommandLine();
+          break;
+        case UART_FIFO_OVF:
+        case UART_BUFFER_FULL:
+          uart_flush_input(STM32_UART);
+          xQueueReset(uartQueue);
+          break;
+        default:
+          break;                        // UART_DATA: si aspetta il '\n'
       }
     }
 
-    vTaskDelay(10 / portTICK_PERIOD_MS);  // evita uso eccessivo della CPU
+    if (warmupActive) {
+      if (millis() - warmupStart >= WARMUP_TIMEOUT_MS) {
+        // nessun trigger: lo STM32 avrebbe dovuto annullare, si spegne comunque
+        flashRelease(false);
+      } else if (!ringReady) {
+        // scarta un frame: tiene il sensore in streaming e fa lavorare AE/AWB
+        // (con il ring attivo lo fa gia' captureTask); la convergenza si conta da qui
+        camera_fb_t * fb = esp_camera_fb_get();
+        if (fb) {
+          aeFrameSettled(esp_timer_get_time());
+          esp_camera_fb_return(fb);
+        }
+      }
+    }
+#if POWER_SAVE
+    else if (!sensorStandby && millis() - lastCommandMs >= POWER_IDLE_MS) {
+      portENTER_CRITICAL(&flashMux);
+      bool idle = jobsInFlight == 0;
+      portEXIT_CRITICAL(&flashMux);
+      if (idle) powerStandby();
+      else lastCommandMs = millis();    // accesso ancora in corso: si riprova piu' tardi
+    }
+#endif
   }
 }
 
 void loop() {
-
-  //attesa attiva
-   delay(100);
+  // tutto il lavoro e' nei task della pipeline: il task di loop() non serve piu'
+  vTaskDelete(NULL);
 }
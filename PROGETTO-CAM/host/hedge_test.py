@@ -0,0 +1,202 @@
+"""
+Prova dei duplicati, del failover e delle riprove tra due server (make hedge).
+
+Avvia due canali binari di stub_server.py nello stesso processo, ne cambia il
+comportamento tra un accesso e l'altro (lento, caduto, normale) e pilota
+spyhole_host da stdin come farebbe lo STM32. Per ogni accesso controlla quale
+server ha ricevuto l'immagine e l'evento [HEDGE] stampato dall'host; ogni fase
+si ripete scambiando i ruoli dei due server. Esce con 1 al primo controllo
+fallito.
+
+Uso:
+    python3 hedge_test.py --host-bin ./spyhole_hedge --frames <cartella jpg> --reprobe-ms 3000
+spyhole_hedge va compilato con -DSERVER_REPROBE_MS uguale a --reprobe-ms (vedi Makefile).
+"""
+import argparse
+import contextlib
+import io
+import os
+import subprocess
+import sys
+import threading
+import time
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..', 'SERVER-Spyhole'))
+from stub_server import start_binary_server  # noqa: E402
+
+RECONNECT_BACKOFF_S = 0.5                # RECONNECT_BACKOFF_MS di spyhole_core.h
+STEADY_ACCESSES = 3                      # accessi normali dopo ogni cambio di server
+
+
+class TestFailed(Exception):
+    pass
+
+
+def check(cond, what):
+    if not cond:
+        raise TestFailed(what)
+
+
+def eventually(cond, seconds=1.0):
+    """cond() diventa vera entro seconds (il thread dello stub conta la connessione dopo l'accept)"""
+    deadline = time.monotonic() + seconds
+    while not cond():
+        if time.monotonic() > deadline:
+            return False
+        time.sleep(0.01)
+    return True
+
+
+class Host:
+    """spyhole_host in modo interattivo: i comandi dello STM32 su stdin"""
+
+    def __init__(self, binary, frames, servers):
+        args = [binary, '-f', frames, '-n']
+        for name in servers:
+            args += ['-s', name]
+        self.proc = subprocess.Popen(args, stdin=subprocess.PIPE, stdout=subprocess.PIPE, text=True)
+        self.next_id = 0
+
+    def command(self, line=None):
+        """Invia line (se c'e') seguito da "C" e ritorna le righe stampate prima di [WARMUP] off"""
+        self.proc.stdin.write((line + '\n' if line else '') + 'C\n')
+        self.proc.stdin.flush()
+        lines = []
+        while True:
+            out = self.proc.stdout.readline()
+            if not out:
+                raise TestFailed('spyhole_host terminato (codice %s)' % self.proc.poll())
+            out = out.rstrip('\n')
+            if out == '[WARMUP] off':
+                return lines
+            lines.append(out)
+
+    def access(self, stubs):
+        """Un accesso: evento [HEDGE] (o None) e immagini ricevute da ciascun server"""
+        before = [s.images for s in stubs]
+        self.next_id = (self.next_id + 1) % 10
+        lines = self.command('2:%d' % self.next_id)
+        check(any(line in ('Y%d' % self.next_id, 'N%d' % self.next_id) for line in lines),
+              'nessun verdetto per la richiesta %d: %s' % (self.next_id, lines))
+        event = next((line.split(' ', 1)[1] for line in lines if line.startswith('[HEDGE] ')), None)
+        return event, [s.images - b for s, b in zip(stubs, before)]
+
+    def close(self):
+        self.proc.stdin.close()
+        self.proc.wait(timeout=5)
+
+
+def steady(host, stubs, names):
+    """Accessi normali: uno solo dei server riceve l'immagine, niente duplicati; ritorna quale"""
+    served = None
+    for _ in range(STEADY_ACCESSES):
+        event, got = host.access(stubs)
+        check(event is None, 'evento inatteso in un accesso normale: %s' % event)
+        check(sorted(got) == [0, 1], 'accesso normale ricevuto da %s' % got)
+        served = got.index(1)
+    return served
+
+
+def run(args, stubs, names, report):
+    host = Host(args.host_bin, args.frames, names)
+    try:
+        # avvio: entrambi veloci, gli accessi vanno al primo registrato
+        for _ in range(STEADY_ACCESSES):
+            event, got = host.access(stubs)
+            check(event is None and got == [1, 0], 'avvio: evento %s, immagini %s' % (event, got))
+        primary = 0
+        print('[TEST] avvio: %s principale' % names[primary], file=report)
+
+        # duplicati: il principale rallenta, vince il duplicato e l'altro diventa principale
+        for r in range(args.rounds):
+            other = 1 - primary
+            stubs[primary].delay_ms = args.slow_ms
+            event, got = host.access(stubs)
+            check(got == [1, 1], 'duplicato %d: immagini %s' % (r, got))
+            check(event is not None and event.startswith('hedge,won=%s,' % names[other]),
+                  'duplicato %d: evento %s' % (r, event))
+            after_ms = int(event.rsplit('=', 1)[1])
+            check(after_ms < args.slow_ms, 'duplicato %d: verdetto dopo %d ms' % (r, after_ms))
+            served = steady(host, stubs, names)
+            check(served == other, 'duplicato %d: gli accessi restano su %s' % (r, names[served]))
+            time.sleep(args.slow_ms / 1000.0 + 0.1)     # il server lento chiude la richiesta persa
+            stubs[primary].delay_ms = args.fast_ms
+            print('[TEST] duplicato %d: %s lento, vince %s dopo %d ms' % (r, names[primary], names[other], after_ms),
+                  file=report)
+            primary = other
+
+        # failover: il principale chiude la connessione, poi torna e l'host si riconnette
+        for r in range(args.rounds):
+            other = 1 - primary
+            stubs[primary].drop = True
+            event, got = host.access(stubs)
+            stubs[primary].drop = False
+            check(got == [1, 1], 'failover %d: immagini %s' % (r, got))
+            check(event is not None and event.startswith('failover,won=%s,' % names[other]),
+                  'failover %d: evento %s' % (r, event))
+            connections = stubs[primary].connections
+            time.sleep(RECONNECT_BACKOFF_S + 0.2)
+            host.command()
+            check(eventually(lambda: stubs[primary].connections == connections + 1),
+                  'failover %d: %s non riconnesso dopo il backoff' % (r, names[primary]))
+            served = steady(host, stubs, names)
+            check(served == other, 'failover %d: gli accessi tornano su %s appena caduto' % (r, names[served]))
+            print('[TEST] failover %d: %s caduto e riconnesso, vince %s' % (r, names[primary], names[other]),
+                  file=report)
+            primary = other
+
+        # riprova: dopo SERVER_REPROBE_MS senza accessi entrambi sono senza misure
+        # recenti e ciascuno, escluso il migliore del momento, riceve un accesso
+        for r in range(args.rounds):
+            time.sleep(args.reprobe_ms / 1000.0 + 0.2)
+            probed = []
+            for _ in range(2):
+                event, got = host.access(stubs)
+                check(sorted(got) == [0, 1], 'riprova %d: immagini %s' % (r, got))
+                if event is None:
+                    break
+                check(event.startswith('probe,won=%s,' % names[got.index(1)]) and got.index(1) not in probed,
+                      'riprova %d: evento %s dopo %s' % (r, event, probed))
+                probed.append(got.index(1))
+            check(probed, 'riprova %d: nessun server riprovato' % r)
+            steady(host, stubs, names)
+            print('[TEST] riprova %d: %s' % (r, ', '.join(names[i] for i in probed)), file=report)
+    finally:
+        host.close()
+
+
+def timeout():
+    print('ERRORE: la prova non e\' finita entro 120 s', file=sys.stderr)
+    os._exit(2)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--host-bin', default='./spyhole_hedge')
+    parser.add_argument('--frames', default='../../SERVER-Spyhole/known_pictures')
+    parser.add_argument('--ports', type=int, nargs=2, default=(5601, 5603))
+    parser.add_argument('--fast-ms', type=int, default=20)
+    parser.add_argument('--slow-ms', type=int, default=800)
+    parser.add_argument('--reprobe-ms', type=int, default=3000, help='SERVER_REPROBE_MS di --host-bin')
+    parser.add_argument('--rounds', type=int, default=4, help='ripetizioni di ogni fase')
+    args = parser.parse_args()
+
+    stubs = [start_binary_server('127.0.0.1', port, args.fast_ms) for port in args.ports]
+    names = ['127.0.0.1:%d' % port for port in args.ports]
+    report = sys.stdout
+    # un accesso bloccato non deve bloccare la CI
+    watchdog = threading.Timer(120, timeout)
+    watchdog.daemon = True
+    watchdog.start()
+    try:
+        with contextlib.redirect_stdout(io.StringIO()):   # righe [LAT]/[HEDGE] degli stub
+            run(args, stubs, names, report)
+    except TestFailed as e:
+        print('ERRORE: %s' % e, file=sys.stderr)
+        return 1
+    print('[TEST] ok: %d duplicati, %d failover, %d riprove' % (args.rounds, args.rounds, args.rounds))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
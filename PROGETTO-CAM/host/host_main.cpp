@@ -0,0 +1,391 @@
+// Esecuzione su Linux della logica dell'ESP32-CAM (spyhole_core) senza scheda:
+// la camera serve i JPEG di una cartella, il trasporto e' un socket TCP verso
+// il server locale (app.py o stub_server.py, canale binario) e la "UART" e'
+// stdin/stdout. Serve per provare i comandi a mano e per misurare in CI
+// latenza per stadio e memoria di un accesso.
+//
+//   ./spyhole_host -f <cartella jpg> [-s host:porta ...] [-c ms cattura] [-b accessi] [-n]
+//
+// Senza -b legge i comandi dello STM32 ("P", "C", "2:<id>") da stdin.
+// Con -b fallisce se un accesso fa anche una sola allocazione dinamica.
+// -n disattiva la deduplica: ogni accesso carica il JPEG.
+// -s ripetuto registra piu' server, nell'ordine: failover e duplicati (hedging).
+
+#include "../spyhole_core.h"
+
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <errno.h>
+#include <malloc.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <new>
+#include <string>
+#include <vector>
+
+// Allocazioni fatte dal codice dell'accesso (core e porte di questo file):
+// malloc & co. sono avvolte dal linker (-Wl,--wrap, vedi Makefile),
+// operator new e' ridefinito qui
+static unsigned long allocations = 0;
+
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+  allocations++;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+  allocations++;
+  return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  allocations++;
+  return __real_realloc(ptr, size);
+}
+}
+
+void *operator new(size_t size) {
+  allocations++;
+  void *p = __real_malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) noexcept {
+  free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+  free(p);
+}
+
+int64_t coreNowUs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void coreIdle() {
+  usleep(1000);
+}
+
+void coreConfigChanged(uint8_t key, uint16_t value) {
+  printf("[CONFIG] chiave %u = %u\n", key, value);
+}
+
+// glibc non espone il blocco libero piu' grande: largestBlock resta 0
+void coreHeapStats(CoreHeap *heap) {
+  static uint32_t minFree = UINT32_MAX;
+  struct mallinfo2 mi = mallinfo2();
+  heap->freeBytes = (uint32_t)std::min<size_t>(mi.fordblks, UINT32_MAX);
+  minFree = std::min(minFree, heap->freeBytes);
+  heap->minFree = minFree;
+  heap->largestBlock = 0;
+}
+
+// Legge width/height dal marker SOF del JPEG; 0x0 se non lo trova
+static void jpegSize(const std::vector<uint8_t> &jpg, uint16_t *w, uint16_t *h) {
+  *w = *h = 0;
+  size_t i = 2;
+  while (i + 9 < jpg.size() && jpg[i] == 0xFF) {
+    uint8_t marker = jpg[i + 1];
+    uint16_t len = (jpg[i + 2] << 8) | jpg[i + 3];
+    if (marker >= 0xC0 && marker <= 0xC3) {
+      *h = (jpg[i + 5] << 8) | jpg[i + 6];
+      *w = (jpg[i + 7] << 8) | jpg[i + 8];
+      return;
+    }
+    i += 2 + len;
+  }
+}
+
+// Camera finta: i JPEG di una cartella a rotazione, con un tempo di
+// acquisizione simulato (sensore + burst della scheda)
+class FileCamera : public CameraPort {
+public:
+  FileCamera(unsigned captureMs) : captureMs(captureMs), next(0) {}
+
+  bool load(const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) return false;
+    std::vector<std::string> names;
+    while (struct dirent *e = readdir(d)) {
+      std::string name = e->d_name;
+      std::string ext = name.size() > 4 ? name.substr(name.find_last_of('.') + 1) : "";
+      if (ext == "jpg" || ext == "jpeg" || ext == "JPG") names.push_back(std::string(dir) + "/" + name);
+    }
+    closedir(d);
+    std::sort(names.begin(), names.end());
+
+    for (const std::string &path : names) {
+      FILE *f = fopen(path.c_str(), "rb");
+      if (!f) continue;
+      std::vector<uint8_t> data;
+      uint8_t chunk[4096];
+      size_t n;
+      while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) data.insert(data.end(), chunk, chunk + n);
+      fclose(f);
+      frames.push_back(data);
+    }
+    return !frames.empty();
+  }
+
+  bool acquire(int64_t sinceUs, CoreFrame *frame) {
+    if (captureMs) usleep(captureMs * 1000);
+    const std::vector<uint8_t> &jpg = frames[next];
+    next = (next + 1) % frames.size();
+    frame->buf = jpg.data();
+    frame->len = jpg.size();
+    jpegSize(jpg, &frame->width, &frame->height);
+    frame->handle = (void *)&jpg;
+    return true;
+  }
+
+  void release(CoreFrame *frame) {}
+
+  // Senza decoder JPEG basta l'uguaglianza dei byte: FNV-1a a 64 bit del file,
+  // quindi la stessa immagine ripetuta viene deduplicata e due diverse no
+  uint64_t fingerprint(const CoreFrame *frame) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < frame->len; i++) h = (h ^ frame->buf[i]) * 1099511628211ULL;
+    return h ? h : 1;
+  }
+
+private:
+  std::vector<std::vector<uint8_t> > frames;
+  unsigned captureMs;
+  size_t next;
+};
+
+class PosixSocket : public Socket {
+public:
+  PosixSocket(const char *host, const char *port) : host(host), port(port), fd(-1) {}
+
+  bool connect() {
+    struct addrinfo hints = {}, *res = NULL;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res) != 0) return false;
+    for (struct addrinfo *a = res; a && fd < 0; a = a->ai_next) {
+      fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+      if (fd < 0) continue;
+      if (::connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+        close(fd);
+        fd = -1;
+      }
+    }
+    freeaddrinfo(res);
+    if (fd < 0) return false;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return true;
+  }
+
+  // Come WiFiClient: false quando il server ha chiuso e non restano dati
+  bool connected() {
+    if (fd < 0) return false;
+    uint8_t b;
+    ssize_t n = recv(fd, &b, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+      stop();
+      return false;
+    }
+    return true;
+  }
+
+  size_t write(const uint8_t *buf, size_t len) {
+    size_t sent = 0;
+    while (fd >= 0 && sent < len) {
+      ssize_t n = send(fd, buf + sent, len - sent, MSG_NOSIGNAL);
+      if (n <= 0) break;
+      sent += n;
+    }
+    return sent;
+  }
+
+  int available() {
+    int n = 0;
+    if (fd < 0 || ioctl(fd, FIONREAD, &n) != 0) return 0;
+    return n;
+  }
+
+  int read(uint8_t *buf, size_t len) {
+    return fd < 0 ? -1 : (int)recv(fd, buf, len, MSG_DONTWAIT);
+  }
+
+  void stop() {
+    if (fd >= 0) close(fd);
+    fd = -1;
+  }
+
+private:
+  const char *host;
+  const char *port;
+  int fd;
+};
+
+// Le risposte allo STM32 ("Y<id>"/"N<id>") su stdout, una per riga
+class StdoutSerial : public SerialPort {
+public:
+  StdoutSerial() : replies(0), granted(0), quiet(false) {}
+
+  void write(const char *buf, size_t len) {
+    replies++;
+    if (buf[0] == 'Y') granted++;
+    if (!quiet) {
+      fwrite(buf, 1, len, stdout);
+      fputc('\n', stdout);
+      fflush(stdout);
+    }
+  }
+
+  unsigned replies;
+  unsigned granted;
+  bool quiet;
+};
+
+static void runAccess(char requestId, CameraPort *camera, SerialPort *serial) {
+  CoreJob job;
+  coreTrigger(&job, requestId, 0);
+  coreCapture(camera, &job);
+  coreFinish(&job, camera, serial);
+}
+
+// Percentili per stadio e memoria a fine benchmark, una riga per misura
+static void printReport(unsigned accesses, const StdoutSerial *serial, long heapDelta, unsigned long allocs) {
+  printf("accessi=%u risposte=%u Y=%u dedup=%lu\n", accesses, serial->replies, serial->granted, dedupHits);
+  for (int i = 0; i < STAGE_COUNT; i++) {
+    const StageStats *s = &stageStats[i];
+    if (!s->count) continue;
+    uint32_t sorted[LAT_WINDOW];
+    memcpy(sorted, s->samples, s->count * sizeof(uint32_t));
+    std::sort(sorted, sorted + s->count);
+    printf("%-8s n=%-3u p50=%.2f ms p95=%.2f ms max=%.2f ms\n", stageNames[i], s->count,
+           sorted[(s->count - 1) / 2] / 1000.0, sorted[(s->count - 1) * 95 / 100] / 1000.0, sorted[s->count - 1] / 1000.0);
+  }
+  for (int i = 0; coreServerCount > 1 && i < coreServerCount; i++) {
+    const CoreServer *s = &coreServers[i];
+    printf("server %s media=%lu ms scarto=%lu ms errori=%u vinti=%u duplicati=%u\n", s->name, (unsigned long)s->ewmaMs,
+           (unsigned long)s->devMs, s->failures, s->wins, s->hedges);
+  }
+
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  printf("alloc=%lu heap_delta=%ld B maxrss=%ld kB job=%zu B stats=%zu B\n", allocs, heapDelta, ru.ru_maxrss, sizeof(CoreJob), sizeof(stageStats));
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr, "uso: %s -f <cartella jpg> [-s host:porta ...] [-c ms cattura] [-b accessi] [-d device id] [-n]\n", prog);
+}
+
+int main(int argc, char **argv) {
+  const char *frames = NULL;
+  std::vector<std::string> servers;
+  unsigned captureMs = 0;
+  unsigned bench = 0;
+  deviceId = 0x00C0FFEE;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "f:s:c:b:d:n")) != -1) {
+    switch (opt) {
+      case 'f': frames = optarg; break;
+      case 's': servers.push_back(optarg); break;
+      case 'c': captureMs = atoi(optarg); break;
+      case 'b': bench = atoi(optarg); break;
+      case 'd': deviceId = strtoul(optarg, NULL, 16); break;
+      case 'n': dedupEnabled = false; break;
+      default: usage(argv[0]); return 2;
+    }
+  }
+  if (servers.empty()) servers.push_back("127.0.0.1:5001");
+  if (!frames || servers.size() > CORE_MAX_SERVERS) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  // host e porta restano in hosts/ports per tutta l'esecuzione (PosixSocket non li copia)
+  std::vector<std::string> hosts, ports;
+  for (const std::string &server : servers) {
+    size_t colon = server.rfind(':');
+    if (colon == std::string::npos) {
+      usage(argv[0]);
+      return 2;
+    }
+    hosts.push_back(server.substr(0, colon));
+    ports.push_back(server.substr(colon + 1));
+  }
+  std::vector<PosixSocket *> sockets;
+  for (size_t i = 0; i < servers.size(); i++) {
+    sockets.push_back(new PosixSocket(hosts[i].c_str(), ports[i].c_str()));
+    coreAddServer(new BinaryTransport(sockets[i]), servers[i].c_str());
+  }
+
+  FileCamera camera(captureMs);
+  if (!camera.load(frames)) {
+    fprintf(stderr, "nessun JPEG in %s\n", frames);
+    return 1;
+  }
+  StdoutSerial serial;
+
+  if (bench) {
+    serial.quiet = true;
+    for (size_t i = 0; i < sockets.size(); i++) {
+      if (!sockets[i]->connect()) {
+        fprintf(stderr, "server %s non raggiungibile\n", servers[i].c_str());
+        return 1;
+      }
+    }
+    runAccess(0, &camera, &serial);     // riscaldamento: allocazioni di libc e del socket
+    memset(stageStats, 0, sizeof(stageStats));
+    serial.replies = serial.granted = 0;
+    dedupHits = 0;
+    size_t heapBefore = mallinfo2().uordblks;
+    unsigned long allocsBefore = allocations;
+    for (unsigned i = 0; i < bench; i++) runAccess('0' + i % 10, &camera, &serial);
+    // prima di printf, che alloca il buffer di stdout
+    unsigned long allocs = allocations - allocsBefore;
+    long heapDelta = (long)mallinfo2().uordblks - (long)heapBefore;
+    printReport(bench, &serial, heapDelta, allocs);
+    if (allocs) {
+      fprintf(stderr, "ERRORE: %lu allocazioni in %u accessi, il percorso dell'accesso deve usare solo buffer statici\n",
+              allocs, bench);
+      return 3;
+    }
+    return 0;
+  }
+
+  char line[64];
+  while (fgets(line, sizeof(line), stdin)) {
+    line[strcspn(line, "\n")] = '\0';
+    char requestId = 0;
+    switch (coreParseCommand(line, &requestId)) {
+      case CMD_PREPARE: printf("[WARMUP] on\n"); break;
+      case CMD_CANCEL: printf("[WARMUP] off\n"); break;
+      case CMD_TRIGGER:
+        runAccess(requestId, &camera, &serial);
+        printf("[STAGES] %s dedup=%lu\n", lastStages, dedupHits);
+        if (hedgeLog[0]) printf("[HEDGE] %s\n", hedgeLog);
+        break;
+      default: break;
+    }
+    coreMaintain();
+    fflush(stdout);                     // stdin/stdout possono essere pipe (hedge_test.py)
+  }
+  return 0;
+}
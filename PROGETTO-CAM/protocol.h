@@ -0,0 +1,72 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+
+// Canale binario ESP32-CAM <-> server (porta BIN_PORT, TCP persistente).
+// Tutti i campi sono little-endian, come l'ESP32. Lo stesso formato e'
+// implementato in SERVER-Spyhole/app.py (BIN_REQUEST / BIN_REPLY).
+//
+// Richiesta: header di 20 byte, poi metaLen byte di testo "chiave=valore;..."
+// (telemetria, facoltativo) e payloadLen byte di JPEG.
+// Risposta: frame fisso di 16 byte. Il server puo' inviare frame BIN_CONFIG
+// in qualsiasi momento, anche mentre l'ESP32 attende un verdetto.
+
+#define BIN_PORT 5001
+#define BIN_VERSION 1
+#define BIN_MAX_PAYLOAD (5 * 1024 * 1024)
+
+enum {
+  BIN_IMAGE   = 0x01,                   // JPEG da riconoscere
+  BIN_PING    = 0x02,                   // keep-alive, payload vuoto
+  BIN_STATS   = 0x03,                   // riepilogo latenze nel meta, nessuna risposta
+  BIN_VERDICT = 0x81,
+  BIN_PONG    = 0x82,
+  BIN_CONFIG  = 0x83                    // configurazione inviata dal server
+};
+
+enum {
+  BIN_FLAG_FACE_CROP = 0x01,            // il JPEG e' gia' il ritaglio del volto
+  BIN_FLAG_REPEAT    = 0x02             // nessun JPEG: frame uguale al precedente, ripetere il verdetto
+};
+
+enum {
+  BIN_CFG_ADAPT_TARGET_MS = 1,          // latenza obiettivo del controllo adattivo
+  BIN_CFG_ADAPT_ENABLED   = 2,
+  BIN_CFG_STATS_REQUEST   = 3,          // l'ESP32 risponde con un frame BIN_STATS
+  BIN_CFG_DEDUP_ENABLED   = 4           // riferimenti BIN_FLAG_REPEAT al posto dei frame ripetuti
+};
+
+#define BIN_SCORE_NO_FACE 0xFFFF
+#define BIN_VERDICT_RESEND 'R'          // risultato precedente scaduto: inviare il JPEG
+
+typedef struct __attribute__((packed)) {
+  char magic[2];                        // "SH"
+  uint8_t version;
+  uint8_t type;
+  uint32_t deviceId;
+  uint16_t requestId;
+  uint8_t flags;
+  uint8_t reserved;
+  uint16_t metaLen;
+  uint16_t reserved2;
+  uint32_t payloadLen;
+} BinRequest;
+
+typedef struct __attribute__((packed)) {
+  char magic[2];                        // "SH"
+  uint8_t version;
+  uint8_t type;
+  uint16_t requestId;                   // quello della richiesta (0 per BIN_CONFIG)
+  uint8_t verdict;                      // 'Y' / 'N' / BIN_VERDICT_RESEND
+  uint8_t configKey;                    // solo BIN_CONFIG
+  uint16_t score;                       // distanza del volto x1000, BIN_SCORE_NO_FACE se assente
+  uint16_t userId;                      // id dell'utente riconosciuto, 0 se nessuno
+  uint16_t serverMs;                    // tempo di riconoscimento
+  uint16_t configValue;                 // solo BIN_CONFIG
+} BinReply;
+
+static_assert(sizeof(BinRequest) == 20, "BinRequest deve essere di 20 byte");
+static_assert(sizeof(BinReply) == 16, "BinReply deve essere di 16 byte");
+
+#endif
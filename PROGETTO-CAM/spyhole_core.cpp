@@ -0,0 +1,557 @@
+#include "spyhole_core.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+uint32_t deviceId = 0;
+unsigned long lastLatencyMs = 0;
+bool lastReused = false;
+unsigned long lastUploadMs = 0;
+unsigned long lastServerMs = 0;
+size_t lastUploadBytes = 0;
+char adaptLog[112] = "";
+char wifiLog[48] = "";
+char powerLog[48] = "";
+char aeLog[64] = "";
+char hedgeLog[64] = "";
+char lastStages[96] = "";
+bool dedupEnabled = true;
+unsigned long dedupHits = 0;
+
+CoreServer coreServers[CORE_MAX_SERVERS];
+int coreServerCount = 0;
+StageStats stageStats[STAGE_COUNT];
+const char *stageNames[STAGE_COUNT] = { "frame", "connect", "upload", "server", "reply", "total" };
+const uint16_t latBucketMs[LAT_BUCKETS - 1] = { 5, 10, 25, 50, 100, 250, 500, 1000, 2500 };   // limiti superiori, l'ultimo bucket e' aperto
+
+static char statsBuf[768];              // stadi e salute dei server
+static uint64_t dedupFingerprint = 0;   // ultimo frame caricato per intero
+static unsigned long dedupAtMs = 0;     // e quando e' arrivato il suo verdetto
+
+// "P", "C", "2" o "2:<id>" (trim di '\r' e spazi finali)
+CoreCommand coreParseCommand(char *line, char *requestId) {
+  size_t n = strlen(line);
+  while (n > 0 && (line[n - 1] == '\r' || line[n - 1] == ' ')) line[--n] = '\0';
+
+  if (strcmp(line, "P") == 0) return CMD_PREPARE;
+  if (strcmp(line, "C") == 0) return CMD_CANCEL;
+  if (strcmp(line, "2") == 0 || strncmp(line, "2:", 2) == 0) {
+    *requestId = (line[1] == ':') ? line[2] : 0;
+    return CMD_TRIGGER;
+  }
+  return CMD_NONE;
+}
+
+void coreTrigger(CoreJob *job, char requestId, int64_t sinceUs) {
+  memset(job, 0, sizeof(*job));
+  job->requestId = requestId;
+  job->sinceUs = sinceUs;
+  job->t.trigger = coreNowUs();
+}
+
+// Frame per il job: senza frame il verdetto e' gia' 'N' (lo STM32 non aspetta la deadline)
+void coreCapture(CameraPort *camera, CoreJob *job) {
+  job->verdict = 'N';
+  if (!camera->acquire(job->sinceUs, &job->frame)) return;
+
+  job->buf = job->frame.buf;
+  job->len = job->frame.len;
+  job->verdict = 0;
+  job->fingerprint = camera->fingerprint(&job->frame);
+  camera->prepare(job);
+  job->t.frame = coreNowUs();
+}
+
+// "<Y|N><id>": l'ID viene ripetuto dopo il verdetto, cosi' lo STM32 scarta
+// le risposte arrivate dopo la sua deadline
+void coreReply(SerialPort *serial, char verdict, char requestId) {
+  char reply[2] = { verdict, requestId };
+  serial->write(reply, requestId ? 2 : 1);
+}
+
+// Un tentativo di upload in corso su un server
+typedef struct {
+  CoreServer *server;
+  StageTimes t;
+  unsigned long startMs;
+  bool reused;
+  bool active;
+  bool probe;                           // riprova di un server senza misure recenti
+} CoreAttempt;
+
+int coreAddServer(Transport *transport, const char *name) {
+  if (coreServerCount == CORE_MAX_SERVERS) return -1;
+  CoreServer *s = &coreServers[coreServerCount];
+  memset(s, 0, sizeof(*s));
+  s->transport = transport;
+  s->name = name;
+  s->backoffMs = RECONNECT_BACKOFF_MS;
+  s->probedMs = coreNowMs();
+  return coreServerCount++;
+}
+
+static bool serverUp(const CoreServer *s) {
+  return (long)(coreNowMs() - s->downUntilMs) >= 0;
+}
+
+// Dopo quanto affiancare un duplicato a un upload su questo server
+static unsigned long serverHedgeMs(const CoreServer *s) {
+  if (!s->ewmaMs) return HEDGE_DEFAULT_MS;
+  return std::min(std::max((unsigned long)(s->ewmaMs + 4 * s->devMs), (unsigned long)HEDGE_MIN_MS), (unsigned long)HEDGE_MAX_MS);
+}
+
+// Misura invio -> verdetto, con i pesi dell'RTO di TCP (1/8 la media, 1/4 lo scarto)
+static void serverSample(CoreServer *s, unsigned long ms) {
+  s->probedMs = coreNowMs();
+  if (!s->ewmaMs) {
+    s->ewmaMs = std::max(ms, 1UL);
+    s->devMs = ms / 2;
+  } else {
+    unsigned long diff = ms > s->ewmaMs ? ms - s->ewmaMs : s->ewmaMs - ms;
+    s->devMs = (3 * s->devMs + diff) / 4;
+    s->ewmaMs = std::max((7 * s->ewmaMs + ms) / 8, 1UL);
+  }
+}
+
+// Il duplicato ha vinto e questo server non ha ancora risposto: la sua latenza
+// e' almeno ms. Sposta solo la media: un limite inferiore non dice nulla sullo
+// scarto e, contato come misura, lo farebbe crescere a ogni duplicato fino a
+// portare la soglia oltre la latenza del server lento.
+static void serverCensored(CoreServer *s, unsigned long ms) {
+  if (!s->ewmaMs) {
+    s->ewmaMs = std::max(ms, 1UL);
+  } else if (ms > s->ewmaMs) {
+    s->ewmaMs = (7 * s->ewmaMs + ms) / 8;
+  }
+}
+
+static void serverFailed(CoreServer *s) {
+  s->transport->socket->stop();
+  s->failures++;
+  s->downUntilMs = coreNowMs() + s->backoffMs;
+  s->backoffMs = std::min(s->backoffMs * 2, (unsigned long)RECONNECT_BACKOFF_MAX_MS);
+}
+
+// Il server non ancora provato in questo accesso con la salute migliore:
+// prima quelli senza errori recenti, poi la latenza attesa pesata per gli
+// errori consecutivi; a parita' conta l'ordine di registrazione. -1 se finiti.
+static int serverPick(const bool *tried) {
+  int best = -1;
+  bool bestUp = false;
+  unsigned long bestScore = 0;
+
+  for (int i = 0; i < coreServerCount; i++) {
+    if (tried[i]) continue;
+    const CoreServer *s = &coreServers[i];
+    bool up = serverUp(s);
+    unsigned long score = (s->ewmaMs ? s->ewmaMs : HEDGE_DEFAULT_MS) * (1UL + s->failures);
+    if (best < 0 || (up && !bestUp) || (up == bestUp && score < bestScore)) {
+      best = i;
+      bestUp = up;
+      bestScore = score;
+    }
+  }
+  return best;
+}
+
+// Un server su, diverso dal migliore, senza misure da SERVER_REPROBE_MS; -1 se nessuno
+static int serverStale(int best) {
+  for (int i = 0; i < coreServerCount; i++) {
+    const CoreServer *s = &coreServers[i];
+    if (i != best && serverUp(s) && coreNowMs() - s->probedMs >= SERVER_REPROBE_MS) return i;
+  }
+  return -1;
+}
+
+// Connette (se serve) e avvia l'upload; se il socket riusato era stato chiuso
+// dal server riprova una volta su una connessione nuova.
+// La connessione si apre qui, cosi' il tempo di connessione resta separato dall'upload.
+static bool attemptStart(CoreAttempt *a, const uint8_t *buf, size_t len, uint8_t flags) {
+  Transport *transport = a->server->transport;
+  Socket *socket = transport->socket;
+
+  a->reused = socket->connected();
+  for (int attempt = 0; attempt < 2; attempt++) {
+    if (socket->connected() || socket->connect()) {
+      a->t.connect = coreNowUs();
+      if (transport->start(buf, len, flags, &a->t)) return true;
+    }
+    socket->stop();
+    if (!a->reused) break;              // connessione nuova fallita: inutile riprovare
+    a->reused = false;
+  }
+  return false;
+}
+
+// Avvia l'upload sul miglior server non ancora provato (o prima su first, se
+// >= 0), passando al successivo finche' uno non lo accetta (*failover = almeno
+// un server saltato)
+static bool attemptLaunch(CoreAttempt *a, bool *tried, bool *failover, const StageTimes *t, const uint8_t *buf, size_t len,
+                          uint8_t flags, int first) {
+  int i;
+  while ((i = first >= 0 ? first : serverPick(tried)) >= 0) {
+    a->probe = i == first;
+    first = -1;
+    tried[i] = true;
+    a->server = &coreServers[i];
+    a->t = *t;
+    a->startMs = coreNowMs();
+    if (a->probe) a->server->probedMs = a->startMs;   // una riprova per intervallo, anche se fallisce
+    a->active = attemptStart(a, buf, len, flags);
+    a->server->transport->lastActivity = coreNowMs();
+    if (a->active) return true;
+    serverFailed(a->server);
+    *failover = true;
+  }
+  a->active = false;
+  return false;
+}
+
+// Invia il frame e ritorna la risposta del server (vedi Transport::send), 0 se
+// non arriva da nessuno. Un tentativo che fallisce passa subito al server
+// successivo; uno che tarda oltre serverHedgeMs() viene affiancato da un
+// duplicato e vince il primo verdetto. Un riferimento BIN_FLAG_REPEAT non si
+// duplica: ha senso solo sul server che ha il risultato (gli altri rispondono
+// BIN_VERDICT_RESEND e coreFinish carica il frame).
+char coreUpload(const uint8_t *buf, size_t len, uint8_t flags, bool *reused, StageTimes *t) {
+  bool tried[CORE_MAX_SERVERS] = {};
+  CoreAttempt at[2];                    // il principale e l'eventuale duplicato
+  bool hedged = (flags & BIN_FLAG_REPEAT) != 0;
+  bool failover = false;
+  unsigned long startMs = coreNowMs();
+  unsigned long hedgeMs = 0;
+  char verdict = 0;
+
+  at[1].active = false;
+  int best = serverPick(tried);
+  int stale = (flags & BIN_FLAG_REPEAT) || best < 0 ? -1 : serverStale(best);
+  if (!attemptLaunch(&at[0], tried, &failover, t, buf, len, flags, stale)) return 0;
+  // la riprova non deve costare piu' dell'attesa del migliore
+  hedgeMs = serverHedgeMs(at[0].probe ? &coreServers[best] : at[0].server);
+
+  while (at[0].active || at[1].active) {
+    for (int k = 0; k < 2; k++) {
+      CoreAttempt *a = &at[k];
+      CoreAttempt *other = &at[1 - k];
+      if (!a->active) continue;
+      bool done = a->server->transport->poll(&verdict, &a->t);
+      if (!done && coreNowMs() - a->startMs < BIN_TIMEOUT_MS) continue;
+      a->active = false;
+      a->server->transport->lastActivity = coreNowMs();
+      if (!done || !verdict) {
+        serverFailed(a->server);
+        failover = true;
+        continue;
+      }
+
+      unsigned long now = coreNowMs();
+      if (a->probe) a->server->ewmaMs = 0;   // misure vecchie: la stima riparte da qui
+      serverSample(a->server, now - a->startMs);
+      a->server->failures = 0;
+      a->server->backoffMs = RECONNECT_BACKOFF_MS;
+      a->server->wins++;
+      // l'altro non ha ancora risposto: la sua latenza e' almeno questa
+      if (other->active) serverCensored(other->server, now - other->startMs);
+      if (other->active || k == 1 || failover || a->probe) {
+        snprintf(hedgeLog, sizeof(hedgeLog), "%s,won=%s,after_ms=%lu",
+                 other->active || k == 1 ? "hedge" : failover ? "failover" : "probe", a->server->name, now - startMs);
+      }
+      *reused = a->reused;
+      t->connect = a->t.connect;
+      t->sent = a->t.sent;
+      t->response = a->t.response;
+      return verdict;
+    }
+
+    CoreAttempt *idle = !at[0].active ? &at[0] : !at[1].active ? &at[1] : NULL;
+    CoreAttempt *running = idle == &at[0] ? &at[1] : &at[0];
+    if (!at[0].active && !at[1].active) {
+      if (!attemptLaunch(&at[0], tried, &failover, t, buf, len, flags, -1)) break;
+      hedgeMs = serverHedgeMs(at[0].server);
+    } else if (!hedged && idle && coreNowMs() - running->startMs >= hedgeMs) {
+      hedged = true;
+      if (attemptLaunch(idle, tried, &failover, t, buf, len, flags, -1)) idle->server->hedges++;
+    } else {
+      coreIdle();
+    }
+  }
+  return 0;
+}
+
+// Frame uguale all'ultimo caricato e verdetto ancora valido
+static bool dedupMatch(const CoreJob *job) {
+  return dedupEnabled && job->fingerprint && dedupFingerprint && coreNowMs() - dedupAtMs < DEDUP_FRESH_MS &&
+         __builtin_popcountll(job->fingerprint ^ dedupFingerprint) <= DEDUP_MAX_DISTANCE;
+}
+
+// Ultimo stadio: carica il frame (se serve), risponde sulla seriale, restituisce
+// il frame alla camera e aggiorna la telemetria
+char coreFinish(CoreJob *job, CameraPort *camera, SerialPort *serial) {
+  bool reused = false;
+  char verdict = job->verdict;
+
+  if (!verdict && dedupMatch(job)) {
+    verdict = coreUpload(NULL, 0, job->flags | BIN_FLAG_REPEAT, &reused, &job->t);
+    if (verdict == BIN_VERDICT_RESEND) {
+      verdict = 0;                      // il server non ha piu' il risultato: si carica il frame
+    } else if (verdict) {
+      dedupHits++;
+    } else {
+      verdict = 'N';                    // server irraggiungibile: inutile riprovare con il JPEG
+    }
+  }
+  if (!verdict) {
+    verdict = coreUpload(job->buf, job->len, job->flags, &reused, &job->t);
+    if (verdict == 'Y' || verdict == 'N') {
+      dedupFingerprint = job->fingerprint;
+      dedupAtMs = coreNowMs();
+    } else {
+      verdict = 'N';
+    }
+  }
+
+  coreReply(serial, verdict, job->requestId);
+  job->t.reply = coreNowUs();
+
+  camera->cleanup(job);
+  if (job->frame.handle) camera->release(&job->frame);
+  lastLatencyMs = (unsigned long)((job->t.reply - job->t.trigger) / 1000);
+  lastReused = reused;
+  latRecord(&job->t);
+  return verdict;
+}
+
+// Cura delle connessioni persistenti tra un upload e l'altro: riconnessione
+// con backoff quando cadono, poi ping e messaggi del server (keepAlive)
+void coreMaintain() {
+  for (int i = 0; i < coreServerCount; i++) {
+    CoreServer *s = &coreServers[i];
+    Transport *transport = s->transport;
+    if (!transport->persistent()) continue;
+    if (transport->socket->connected()) {
+      transport->keepAlive();
+      continue;
+    }
+    if (!serverUp(s)) continue;
+    if (transport->socket->connect()) {
+      s->backoffMs = RECONNECT_BACKOFF_MS;
+      transport->lastActivity = coreNowMs();
+    } else {
+      s->downUntilMs = coreNowMs() + s->backoffMs;
+      s->backoffMs = std::min(s->backoffMs * 2, (unsigned long)RECONNECT_BACKOFF_MAX_MS);
+    }
+  }
+}
+
+// Telemetria dell'accesso precedente e stato dell'heap, in formato "chiave=valore;"
+size_t coreBuildMeta(char *meta, size_t size) {
+  CoreHeap heap;
+  coreHeapStats(&heap);
+  int n = snprintf(meta, size, "heap=%lu/%lu/%lu;", (unsigned long)heap.freeBytes, (unsigned long)heap.minFree,
+                   (unsigned long)heap.largestBlock);
+  if (lastLatencyMs && n < (int)size) n += snprintf(meta + n, size - n, "prev_ms=%lu;reused=%d;", lastLatencyMs, lastReused ? 1 : 0);
+  if (lastStages[0] && n < (int)size) n += snprintf(meta + n, size - n, "stages=%s;", lastStages);
+  if (adaptLog[0] && n < (int)size) n += snprintf(meta + n, size - n, "adapt=%s;", adaptLog);
+  if (wifiLog[0] && n < (int)size) n += snprintf(meta + n, size - n, "wifi=%s;", wifiLog);
+  if (powerLog[0] && n < (int)size) n += snprintf(meta + n, size - n, "power=%s;", powerLog);
+  if (aeLog[0] && n < (int)size) n += snprintf(meta + n, size - n, "ae=%s;", aeLog);
+  if (hedgeLog[0] && n < (int)size) n += snprintf(meta + n, size - n, "hedge=%s;", hedgeLog);
+  return std::min((size_t)std::max(n, 0), size - 1);
+}
+
+static int latBucket(uint32_t us) {
+  int b = 0;
+  while (b < LAT_BUCKETS - 1 && us >= latBucketMs[b] * 1000UL) b++;
+  return b;
+}
+
+static void latAdd(StageStats *s, uint32_t us) {
+  if (s->count == LAT_WINDOW) {
+    s->hist[latBucket(s->samples[s->next])]--;   // esce il campione piu' vecchio
+  } else {
+    s->count++;
+  }
+  s->samples[s->next] = us;
+  s->hist[latBucket(us)]++;
+  s->next = (s->next + 1) % LAT_WINDOW;
+}
+
+// Aggiunge un accesso concluso alle finestre e prepara lastStages per
+// l'upload successivo. Gli stadi saltati (es. verdetto deciso senza rete)
+// hanno timestamp 0 e non vengono contati.
+void latRecord(const StageTimes *t) {
+  const int64_t at[] = { t->trigger, t->frame, t->connect, t->sent, t->response, t->reply };
+  int n = 0;
+
+  lastStages[0] = '\0';
+  for (int i = 0; i < STAGE_COUNT; i++) {
+    int64_t from = (i == STAGE_TOTAL) ? t->trigger : at[i];
+    int64_t to = (i == STAGE_TOTAL) ? t->reply : at[i + 1];
+    if (!from || !to || to < from) continue;
+    uint32_t us = (uint32_t)std::min<int64_t>(to - from, 0xFFFFFFFF);
+    latAdd(&stageStats[i], us);
+    if (n < (int)sizeof(lastStages)) {
+      n += snprintf(lastStages + n, sizeof(lastStages) - n, "%s%s:%lu", n ? "," : "", stageNames[i], (unsigned long)(us / 1000));
+    }
+  }
+}
+
+// Riepilogo delle finestre in formato meta: "buckets=5,10,..;frame=n/p50/p95/max;frame_hist=..;" (ms)
+size_t latSummary(char *out, size_t size) {
+  int n = snprintf(out, size, "buckets=");
+  for (int b = 0; b < LAT_BUCKETS - 1; b++) n += snprintf(out + n, size - n, b ? ",%u" : "%u", latBucketMs[b]);
+  n += snprintf(out + n, size - n, ";");
+
+  for (int i = 0; i < STAGE_COUNT && n < (int)size; i++) {
+    const StageStats *s = &stageStats[i];
+    if (!s->count) continue;
+    uint32_t sorted[LAT_WINDOW];
+    memcpy(sorted, s->samples, s->count * sizeof(uint32_t));
+    std::sort(sorted, sorted + s->count);
+    n += snprintf(out + n, size - n, "%s=%u/%lu/%lu/%lu;%s_hist=", stageNames[i], s->count,
+                  (unsigned long)(sorted[(s->count - 1) / 2] / 1000), (unsigned long)(sorted[(s->count - 1) * 95 / 100] / 1000),
+                  (unsigned long)(sorted[s->count - 1] / 1000), stageNames[i]);
+    for (int b = 0; b < LAT_BUCKETS && n < (int)size; b++) n += snprintf(out + n, size - n, b ? ",%u" : "%u", s->hist[b]);
+    if (n < (int)size) n += snprintf(out + n, size - n, ";");
+  }
+  // salute dei server: "servers=nome/media/scarto/errori/vinti/duplicati,..."
+  for (int i = 0; i < coreServerCount && n < (int)size; i++) {
+    const CoreServer *s = &coreServers[i];
+    n += snprintf(out + n, size - n, "%s%s/%lu/%lu/%u/%u/%u", i ? "," : "servers=", s->name, (unsigned long)s->ewmaMs,
+                  (unsigned long)s->devMs, s->failures, s->wins, s->hedges);
+  }
+  if (coreServerCount && n < (int)size) n += snprintf(out + n, size - n, ";");
+  return std::min((size_t)std::max(n, 0), size - 1);
+}
+
+// Scrive una richiesta binaria (header, meta, payload) sul socket
+bool BinaryTransport::sendFrame(uint8_t type, uint8_t flags, const char *meta, size_t metaLen, const uint8_t *payload, size_t len) {
+  BinRequest req = {};
+  req.magic[0] = 'S';
+  req.magic[1] = 'H';
+  req.version = BIN_VERSION;
+  req.type = type;
+  req.deviceId = deviceId;
+  req.requestId = type == BIN_IMAGE ? ++requestId : 0;
+  req.flags = flags;
+  req.metaLen = metaLen;
+  req.payloadLen = len;
+
+  if (socket->write((const uint8_t *)&req, sizeof(req)) != sizeof(req)) return false;
+  if (metaLen && socket->write((const uint8_t *)meta, metaLen) != metaLen) return false;
+  return !len || socket->write(payload, len) == len;
+}
+
+// Legge un frame di risposta entro timeoutMs; i frame BIN_CONFIG vengono
+// applicati qui. Ritorna false su timeout, connessione chiusa o frame non valido.
+bool BinaryTransport::readReply(BinReply *r, unsigned long timeoutMs) {
+  unsigned long start = coreNowMs();
+  size_t got = 0;
+
+  while (got < sizeof(BinReply)) {
+    if (!socket->connected() && !socket->available()) return false;
+    int n = socket->available() ? socket->read((uint8_t *)r + got, sizeof(BinReply) - got) : 0;
+    if (n > 0) {
+      got += n;
+    } else if (coreNowMs() - start >= timeoutMs) {
+      return false;
+    } else {
+      coreIdle();
+    }
+  }
+  if (r->magic[0] != 'S' || r->magic[1] != 'H' || r->version != BIN_VERSION) {
+    socket->stop();                     // flusso desincronizzato
+    return false;
+  }
+  if (r->type == BIN_CONFIG) {
+    if (r->configKey == BIN_CFG_STATS_REQUEST) {
+      statsRequested = true;            // risponde keepAlive quando la connessione e' libera
+    } else if (r->configKey == BIN_CFG_DEDUP_ENABLED) {
+      dedupEnabled = r->configValue != 0;
+    } else {
+      coreConfigChanged(r->configKey, r->configValue);
+    }
+  }
+  return true;
+}
+
+// Attende la risposta di un certo tipo (e requestId), saltando le configurazioni
+bool BinaryTransport::await(uint8_t type, uint16_t id, BinReply *r) {
+  unsigned long start = coreNowMs();
+  while (coreNowMs() - start < BIN_TIMEOUT_MS) {
+    if (!readReply(r, BIN_TIMEOUT_MS - (coreNowMs() - start))) return false;
+    if (r->type == type && r->requestId == id) return true;
+  }
+  return false;
+}
+
+bool BinaryTransport::start(const uint8_t *buf, size_t len, uint8_t flags, StageTimes *t) {
+  char meta[384];
+  size_t metaLen = coreBuildMeta(meta, sizeof(meta));
+
+  sendStart = coreNowMs();
+  if (!sendFrame(BIN_IMAGE, flags, meta, metaLen, buf, len)) return false;
+  t->sent = coreNowUs();
+  sendLen = len;
+  return true;
+}
+
+// Verdetto della richiesta avviata da start(), se e' gia' arrivato. Le risposte
+// a richieste precedenti (il duplicato che ha perso) vengono scartate.
+bool BinaryTransport::poll(char *verdict, StageTimes *t) {
+  BinReply reply;
+
+  while (socket->available() >= (int)sizeof(BinReply)) {
+    if (!readReply(&reply, 0)) break;
+    if (reply.type != BIN_VERDICT || reply.requestId != requestId) continue;
+    t->response = coreNowUs();
+    lastUploadMs = coreNowMs() - sendStart;
+    lastServerMs = reply.serverMs;
+    lastUploadBytes = sendLen;
+    adaptLog[0] = '\0';
+    wifiLog[0] = '\0';
+    powerLog[0] = '\0';
+    aeLog[0] = '\0';
+    hedgeLog[0] = '\0';
+    if (reply.verdict == BIN_VERDICT_RESEND) {
+      *verdict = BIN_VERDICT_RESEND;
+    } else {
+      *verdict = reply.verdict == 'Y' ? 'Y' : 'N';
+    }
+    return true;
+  }
+  if (socket->connected()) return false;
+  *verdict = 0;                         // connessione chiusa o flusso desincronizzato
+  return true;
+}
+
+char BinaryTransport::send(const uint8_t *buf, size_t len, uint8_t flags, StageTimes *t) {
+  char verdict = 0;
+
+  if (!start(buf, len, flags, t)) return 0;
+  while (!poll(&verdict, t)) {
+    if (coreNowMs() - sendStart >= BIN_TIMEOUT_MS) return 0;
+    coreIdle();
+  }
+  return verdict;
+}
+
+void BinaryTransport::keepAlive() {
+  BinReply reply;
+  while (socket->available() >= (int)sizeof(BinReply)) {
+    readReply(&reply, 0);               // configurazione inviata dal server
+  }
+  if (statsRequested) {
+    statsRequested = false;
+    size_t len = latSummary(statsBuf, sizeof(statsBuf));
+    if (!sendFrame(BIN_STATS, 0, statsBuf, len, NULL, 0)) socket->stop();
+    lastActivity = coreNowMs();
+  }
+  if (socket->connected() && coreNowMs() - lastActivity >= PING_INTERVAL_MS) {
+    if (!sendFrame(BIN_PING, 0, NULL, 0, NULL, 0) || !await(BIN_PONG, 0, &reply)) {
+      socket->stop();                   // riconnessione al prossimo giro
+    }
+    lastActivity = coreNowMs();
+  }
+}
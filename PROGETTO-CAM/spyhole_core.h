@@ -0,0 +1,256 @@
+#ifndef SPYHOLE_CORE_H
+#define SPYHOLE_CORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "protocol.h"
+
+// Logica di un accesso indipendente dalla scheda: comandi dello STM32,
+// acquisizione del frame, upload sul canale binario, verdetto e telemetria.
+// L'hardware sta dietro tre porte (CameraPort, Transport/Socket, SerialPort):
+// sulla scheda le implementa PROGETTO-CAM.ino, su Linux host/host_main.cpp con
+// una camera finta che legge file JPEG e un socket verso il server locale.
+// Nessuna allocazione dinamica per accesso: buffer statici o sullo stack e
+// job passati per valore (host/ lo verifica a ogni benchmark).
+
+#ifndef PING_INTERVAL_MS
+#define PING_INTERVAL_MS 15000          // ping se la connessione resta inattiva
+#endif
+#define RECONNECT_BACKOFF_MS 500        // raddoppia a ogni tentativo fallito
+#define RECONNECT_BACKOFF_MAX_MS 8000
+#ifndef BIN_TIMEOUT_MS
+#define BIN_TIMEOUT_MS 10000
+#endif
+
+// Piu' server di riconoscimento (coreAddServer): ogni upload va al server con
+// la salute migliore (latenza invio -> verdetto in media mobile, errori
+// recenti). Se non risponde entro una soglia adattiva (media + 4 deviazioni,
+// come l'RTO di TCP) lo stesso frame parte anche verso il secondo e vince il
+// primo verdetto che arriva; la risposta dell'altro viene scartata quando
+// arriva. Un server che fallisce resta in fondo alla lista con backoff.
+// L'hedging richiede un Transport con start()/poll() non bloccanti (canale
+// binario); con HTTP resta il failover sul server successivo.
+// Un server che non e' il migliore viene misurato solo dai duplicati: se non
+// ha misure da SERVER_REPROBE_MS riceve un upload come principale (con la
+// soglia di duplicazione del migliore) e se risponde la sua stima riparte da
+// quella misura, cosi' un server lento o caduto che si e' ripreso torna in gioco.
+#define CORE_MAX_SERVERS 4
+#define HEDGE_MIN_MS 150
+#define HEDGE_MAX_MS 3000
+#define HEDGE_DEFAULT_MS 1000           // server senza misure
+#ifndef SERVER_REPROBE_MS
+#define SERVER_REPROBE_MS 30000
+#endif
+
+// Telemetria per stadio: ogni accesso registra un timestamp (us) a ogni
+// passaggio e coreFinish tiene una finestra mobile degli ultimi LAT_WINDOW
+// valori per stadio (un solo chiamante, niente mutex). Il dettaglio
+// dell'accesso precedente viaggia con l'upload ("X-Prev-Stages" / meta
+// "stages=", in ms); percentili e istogrammi li chiede il server con
+// BIN_CFG_STATS_REQUEST.
+#define LAT_WINDOW 64
+#define LAT_BUCKETS 10
+
+typedef struct {
+  int64_t trigger;                      // comando "2" ricevuto
+  int64_t frame;                        // frame scelto (ed eventualmente ritagliato)
+  int64_t connect;                      // socket verso il server pronto
+  int64_t sent;                         // richiesta scritta (stimato in HTTP)
+  int64_t response;                     // verdetto ricevuto
+  int64_t reply;                        // risposta scritta sulla seriale
+} StageTimes;
+
+// stadio i = da StageTimes[i] a StageTimes[i + 1]; STAGE_TOTAL = trigger -> reply
+enum { STAGE_FRAME, STAGE_CONNECT, STAGE_UPLOAD, STAGE_SERVER, STAGE_REPLY, STAGE_TOTAL, STAGE_COUNT };
+
+typedef struct {
+  uint32_t samples[LAT_WINDOW];         // us
+  uint16_t hist[LAT_BUCKETS];           // conteggi della finestra corrente
+  uint16_t count;
+  uint16_t next;
+} StageStats;
+
+// Deduplica: ogni frame ha un'impronta percettiva a 64 bit (CameraPort::fingerprint).
+// Se differisce per al piu' DEDUP_MAX_DISTANCE bit da quella dell'ultimo frame
+// caricato e quel verdetto ha meno di DEDUP_FRESH_MS, si invia solo un
+// riferimento (BIN_FLAG_REPEAT, nessun JPEG) e il server ripete il risultato
+// precedente senza rifare il riconoscimento; se non lo ha piu' risponde
+// BIN_VERDICT_RESEND e si carica il frame. Il confronto e' sempre con l'ultimo
+// upload completo, cosi' una scena che cambia piano piano non resta agganciata.
+#define DEDUP_MAX_DISTANCE 6
+#define DEDUP_FRESH_MS 5000
+
+// Heap interno: libero ora, minimo dall'avvio (watermark), blocco piu' grande (frammentazione)
+typedef struct {
+  uint32_t freeBytes;
+  uint32_t minFree;
+  uint32_t largestBlock;
+} CoreHeap;
+
+typedef enum {
+  CMD_NONE,
+  CMD_PREPARE,                          // "P": warm-up speculativo
+  CMD_CANCEL,                           // "C": warm-up annullato
+  CMD_TRIGGER                           // "2[:<id>]": accesso
+} CoreCommand;
+
+typedef struct {
+  const uint8_t *buf;
+  size_t len;
+  uint16_t width;
+  uint16_t height;
+  void *handle;                         // slot del ring / camera_fb_t / file, per release()
+} CoreFrame;
+
+// Un accesso dal trigger alla risposta: passa da uno stadio all'altro per valore
+typedef struct {
+  char requestId;
+  char verdict;                         // gia' deciso senza rete ('N'), 0 = da caricare
+  uint8_t flags;                        // BIN_FLAG_*
+  const uint8_t *buf;                   // dati da caricare: il frame o un suo ritaglio
+  size_t len;
+  int64_t sinceUs;                      // frame validi solo se acquisiti dopo
+  uint64_t fingerprint;                 // impronta del frame intero, 0 = non disponibile
+  CoreFrame frame;
+  StageTimes t;
+} CoreJob;
+
+class CameraPort {
+public:
+  virtual ~CameraPort() {}
+  // Frame JPEG acquisito dopo sinceUs, valido fino a release(); false se non arriva
+  virtual bool acquire(int64_t sinceUs, CoreFrame *frame) = 0;
+  virtual void release(CoreFrame *frame) = 0;
+  // Impronta percettiva del frame per la deduplica, 0 se non disponibile
+  virtual uint64_t fingerprint(const CoreFrame *frame) { return 0; }
+  // Elaborazione locale facoltativa prima dell'upload (es. ritaglio del volto)
+  // e rilascio di quello che prepare() ha preso, dopo la risposta
+  virtual void prepare(CoreJob *job) {}
+  virtual void cleanup(CoreJob *job) {}
+};
+
+// Flusso di byte verso il server: WiFiClient sulla scheda, socket TCP su Linux
+class Socket {
+public:
+  virtual ~Socket() {}
+  virtual bool connect() = 0;
+  virtual bool connected() = 0;
+  virtual size_t write(const uint8_t *buf, size_t len) = 0;
+  virtual int available() = 0;
+  virtual int read(uint8_t *buf, size_t len) = 0;
+  virtual void stop() = 0;
+};
+
+// Protocollo di upload sopra il socket
+class Transport {
+public:
+  explicit Transport(Socket *socket) : socket(socket), lastActivity(0), result(0) {}
+  virtual ~Transport() {}
+  // Un tentativo sul socket gia' connesso: 'Y'/'N' (o BIN_VERDICT_RESEND per un
+  // riferimento BIN_FLAG_REPEAT), 0 se la richiesta e' fallita. Compila t->sent e t->response.
+  virtual char send(const uint8_t *buf, size_t len, uint8_t flags, StageTimes *t) = 0;
+  // Lo stesso tentativo in due tempi, per affiancargli un duplicato su un altro
+  // server: start() scrive la richiesta, poll() ritorna true quando e' concluso
+  // (*verdict come send()). Di default start() fa tutto con send().
+  virtual bool start(const uint8_t *buf, size_t len, uint8_t flags, StageTimes *t) {
+    result = send(buf, len, flags, t);
+    return result != 0;
+  }
+  virtual bool poll(char *verdict, StageTimes *t) {
+    *verdict = result;
+    return true;
+  }
+  // Connessione aperta e senza upload in corso: ping, messaggi del server
+  virtual void keepAlive() {}
+  // false = una connessione nuova per upload, niente riconnessione in background
+  virtual bool persistent() { return true; }
+
+  Socket *socket;
+  unsigned long lastActivity;           // ms, ultimo scambio su questa connessione
+
+protected:
+  char result;
+};
+
+class SerialPort {
+public:
+  virtual ~SerialPort() {}
+  virtual void write(const char *buf, size_t len) = 0;
+};
+
+// Canale binario di protocol.h
+class BinaryTransport : public Transport {
+public:
+  explicit BinaryTransport(Socket *socket)
+      : Transport(socket), requestId(0), sendStart(0), sendLen(0), statsRequested(false) {}
+  char send(const uint8_t *buf, size_t len, uint8_t flags, StageTimes *t);
+  bool start(const uint8_t *buf, size_t len, uint8_t flags, StageTimes *t);
+  bool poll(char *verdict, StageTimes *t);
+  void keepAlive();
+
+private:
+  bool sendFrame(uint8_t type, uint8_t flags, const char *meta, size_t metaLen, const uint8_t *payload, size_t len);
+  bool readReply(BinReply *r, unsigned long timeoutMs);
+  bool await(uint8_t type, uint16_t id, BinReply *r);
+
+  uint16_t requestId;                   // ultima richiesta BIN_IMAGE, quella attesa da poll()
+  unsigned long sendStart;
+  size_t sendLen;
+  bool statsRequested;                  // BIN_CFG_STATS_REQUEST: risponde keepAlive()
+};
+
+// Un server di riconoscimento e la sua salute
+typedef struct {
+  Transport *transport;
+  const char *name;                     // "host:porta", per la telemetria
+  uint32_t ewmaMs;                      // invio -> verdetto, media mobile (0 = nessuna misura)
+  uint32_t devMs;                       // scarto medio dalla media
+  unsigned long downUntilMs;            // dopo un errore si prova per ultimo fino a qui
+  unsigned long backoffMs;
+  unsigned long probedMs;               // ultima misura o ultimo tentativo di riprova
+  uint16_t failures;                    // errori consecutivi
+  uint16_t wins;                        // verdetti arrivati per primi
+  uint16_t hedges;                      // upload ricevuti come duplicato
+} CoreServer;
+
+// Da implementare sulla piattaforma (sketch o host/)
+int64_t coreNowUs();                    // esp_timer_get_time() sulla scheda
+void coreIdle();                        // cede la CPU mentre si aspetta il server
+void coreConfigChanged(uint8_t key, uint16_t value);   // BIN_CONFIG non gestiti dal core (stats, dedup)
+void coreHeapStats(CoreHeap *heap);
+
+static inline unsigned long coreNowMs() { return (unsigned long)(coreNowUs() / 1000); }
+
+// Stato condiviso con la piattaforma
+extern uint32_t deviceId;               // identifica la camera sul server
+extern unsigned long lastLatencyMs;     // trigger -> verdetto dell'ultimo accesso
+extern bool lastReused;
+extern unsigned long lastUploadMs;      // invio -> risposta dell'ultimo upload riuscito
+extern unsigned long lastServerMs;      // tempo di riconoscimento dichiarato dal server
+extern size_t lastUploadBytes;
+extern char adaptLog[112];              // ultima decisione del controllo adattivo, da inviare una volta
+extern char wifiLog[48];                // ultimo collegamento alla rete (tipo, tempo di recupero), idem
+extern char powerLog[48];               // ultimo risveglio dallo standby (risveglio -> frame), idem
+extern char aeLog[64];                  // ultima convergenza dell'esposizione (tempo, frame scartati), idem
+extern char hedgeLog[64];               // ultimo duplicato o failover (server vincente, dopo quanto), idem
+extern bool dedupEnabled;               // BIN_CFG_DEDUP_ENABLED
+extern unsigned long dedupHits;         // accessi risolti con un riferimento
+extern char lastStages[96];             // dettaglio dell'ultimo accesso, "frame:120,connect:0,..."
+extern StageStats stageStats[STAGE_COUNT];
+extern const char *stageNames[STAGE_COUNT];
+extern CoreServer coreServers[CORE_MAX_SERVERS];
+extern int coreServerCount;
+
+int coreAddServer(Transport *transport, const char *name);   // in ordine di preferenza iniziale
+CoreCommand coreParseCommand(char *line, char *requestId);
+void coreTrigger(CoreJob *job, char requestId, int64_t sinceUs);
+void coreCapture(CameraPort *camera, CoreJob *job);
+char coreUpload(const uint8_t *buf, size_t len, uint8_t flags, bool *reused, StageTimes *t);
+char coreFinish(CoreJob *job, CameraPort *camera, SerialPort *serial);
+void coreReply(SerialPort *serial, char verdict, char requestId);
+void coreMaintain();
+size_t coreBuildMeta(char *meta, size_t size);
+void latRecord(const StageTimes *t);
+size_t latSummary(char *out, size_t size);
+
+#endif
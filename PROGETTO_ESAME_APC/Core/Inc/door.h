@@ -0,0 +1,188 @@
+#ifndef __DOOR_H
+#define __DOOR_H
+
+#include "stm32f3xx_hal.h"
+
+/* Numero di porte gestite da un solo controller (1..4).
+ * Porta 1: servo TIM1 CH1 (PA8),  camera USART3 (PB10/PB11), LED RGB PA5-PA7
+ * Porta 2: servo TIM1 CH2 (PA9),  camera USART1 (PC4/PC5)
+ * Porta 3: servo TIM1 CH3 (PA10), camera UART4  (PC10/PC11)
+ * Porta 4: servo TIM1 CH4 (PA11), camera UART5  (PC12/PD2)
+ * Il modulo Bluetooth su USART2 e' condiviso: i comandi per la porta N
+ * si scrivono come "N:Access" / "N:1234" (senza prefisso -> porta 1). */
+#ifndef DOOR_COUNT
+#define DOOR_COUNT 1
+#endif
+
+#if DOOR_COUNT < 1 || DOOR_COUNT > 4
+#error "DOOR_COUNT deve essere compreso tra 1 e 4"
+#endif
+
+/* Defines */
+#define SERVO_STOP   1400
+#define SERVO_OPEN   1000
+#define SERVO_CLOSE  1000
+#define BUFFER_SIZE 64
+#define MAX_FACE_ATTEMPTS 3
+#define LOCKOUT_TIME 10000 // 10 secondi
+#define SERVO_OPEN_TIME 200
+#define SERVO_CLOSE_TIME 200
+#define LED_FAIL_TIME 2000
+
+#define DOOR_CMD_QUEUE_SIZE 2        // comandi Bluetooth in attesa per porta
+#define DOOR_CAM_QUEUE_SIZE 8        // byte ricevuti dalla camera in attesa per porta
+#define DOOR_LATENCY_BUDGET_MS 20    // tempo massimo tra arrivo e gestione di un evento
+#define CONSOLE_TX_SIZE 256
+
+/* Warm-up speculativo della camera: al primo carattere di un possibile
+ * "Access" (o su un fronte del sensore di presenza) la porta invia "P\n"
+ * all'ESP32, che accende il sensore e fa convergere l'esposizione mentre
+ * l'utente finisce di scrivere. Se il comando risulta diverso, o non arriva
+ * entro SPEC_TIMEOUT_MS, la speculazione viene annullata con "C\n". */
+#ifndef DOOR_SPECULATIVE_WARMUP
+#define DOOR_SPECULATIVE_WARMUP 1
+#endif
+#define SPEC_TIMEOUT_MS 5000
+
+/* Tra un accesso e l'altro l'ESP32 va in light sleep e si sveglia sui fronti
+ * della sua RX, ma i caratteri che lo svegliano vanno persi: dopo
+ * CAM_WAKE_IDLE_MS di silenzio verso la camera il comando e' preceduto da
+ * righe vuote (ignorate dall'ESP32) e da CAM_WAKE_GUARD_MS di attesa.
+ * CAM_WAKE_IDLE_MS deve restare sotto POWER_IDLE_MS dello sketch. */
+#define CAM_WAKE_IDLE_MS 1000
+#define CAM_WAKE_GUARD_MS 2
+
+/* Scadenza della risposta della camera. Ogni trigger porta un ID ("2:<id>\n",
+ * id = '0'..'9') che l'ESP32 ripete dopo il verdetto ("Y<id>" / "N<id>"):
+ * le risposte con ID non atteso sono tardive e vengono scartate.
+ * Se la risposta non arriva entro la soglia di hedging (p95 delle ultime
+ * risposte) si invia un secondo trigger; allo scadere della deadline il
+ * tentativo fallisce e dopo MAX_FACE_TIMEOUTS scadenze si passa al PIN. */
+#define FACE_RESPONSE_DEADLINE_MS 8000
+#ifndef FACE_HEDGE_ENABLED
+#define FACE_HEDGE_ENABLED 1
+#endif
+#define FACE_HEDGE_DEFAULT_MS 3000   // soglia usata finché non ci sono abbastanza campioni
+#define FACE_HEDGE_MIN_MS 1000
+#define FACE_LATENCY_SAMPLES 16
+#define FACE_LATENCY_MIN_SAMPLES 4
+#define MAX_FACE_TIMEOUTS 2
+#define AUDIT_LOG_SIZE 32
+
+/* Typedef */
+typedef enum {
+    WAIT_ACCESS_COMMAND,
+    WAIT_FACE_RESPONSE,
+    WAIT_PIN,
+    LOCKOUT
+} AccessState;
+
+typedef enum {
+    AUDIT_BOOT,
+    AUDIT_ACCESS_REQUEST,
+    AUDIT_FACE_GRANTED,
+    AUDIT_FACE_DENIED,
+    AUDIT_PIN_REQUIRED,
+    AUDIT_PIN_GRANTED,
+    AUDIT_PIN_DENIED,
+    AUDIT_LOCKOUT_END,
+    AUDIT_CMD_DROPPED,
+    AUDIT_BUDGET_OVERRUN,
+    AUDIT_SPEC_PREPARE,
+    AUDIT_SPEC_CANCEL,
+    AUDIT_FACE_HEDGE,
+    AUDIT_FACE_TIMEOUT,
+    AUDIT_STALE_REPLY
+} AuditEvent;
+
+typedef enum {
+    SPEC_REQ_NONE,
+    SPEC_REQ_PREPARE,
+    SPEC_REQ_CANCEL
+} SpecRequest;
+
+typedef struct {
+    uint32_t tick;
+    uint8_t door;
+    uint8_t event;
+} AuditEntry;
+
+/* Risorse hardware di una porta */
+typedef struct {
+    TIM_HandleTypeDef *htim;
+    uint32_t servo_channel;
+    UART_HandleTypeDef *cam_uart;
+    GPIO_TypeDef *led_port;          // NULL = porta senza LED RGB
+    uint16_t led_red;
+    uint16_t led_green;
+    uint16_t led_blue;
+    uint16_t presence_pin;           // linea EXTI del sensore di presenza, 0 = assente
+} DoorConfig;
+
+typedef struct {
+    char text[BUFFER_SIZE];
+    uint32_t tick;                   // istante di arrivo (per il budget di latenza)
+} DoorCommand;
+
+/* Contesto di una porta: tutto lo stato che prima era globale in main.c */
+typedef struct {
+    uint8_t id;
+    const DoorConfig *cfg;
+    AccessState access_state;
+
+    /* comandi Bluetooth completi, riempiti dall'ISR e consumati dallo scheduler */
+    DoorCommand cmd_queue[DOOR_CMD_QUEUE_SIZE];
+    volatile uint8_t cmd_head;
+    volatile uint8_t cmd_tail;
+
+    /* byte ricevuti dalla camera */
+    uint8_t cam_byte;
+    volatile uint8_t cam_queue[DOOR_CAM_QUEUE_SIZE];
+    volatile uint32_t cam_tick[DOOR_CAM_QUEUE_SIZE];
+    volatile uint8_t cam_head;
+    volatile uint8_t cam_tail;
+    uint32_t cam_tx_tick;            // ultimo comando inviato alla camera
+
+    /* State management */
+    int face_attempts;
+    int message_sent;
+    uint32_t lockout_timer;
+    uint32_t action_timer;
+    uint8_t action_state; // 0 idle, 1 success, 2 failure, 3 chiusura
+
+    /* warm-up speculativo */
+    volatile uint8_t spec_req;       // SpecRequest, scritto dalle ISR
+    uint8_t spec_active;             // "P" inviato, in attesa del comando
+    uint32_t spec_tick;
+    uint32_t spec_hits;
+    uint32_t spec_misses;
+
+    /* deadline e hedging della risposta camera */
+    char req_id;                     // ID dell'ultimo trigger
+    char hedge_id;                   // ID del trigger di hedging, 0 se non inviato
+    char cam_verdict;                // 'Y'/'N' ricevuto, in attesa dell'ID
+    uint32_t trigger_tick;
+    int face_timeouts;
+    uint16_t face_latency[FACE_LATENCY_SAMPLES]; // ultimi tempi di risposta (ms)
+    uint8_t face_latency_count;
+    uint32_t stale_replies;
+
+    /* statistiche scheduler */
+    uint32_t max_latency_ms;
+    uint32_t budget_overruns;
+    uint32_t dropped_cmds;
+} Door;
+
+extern Door doors[DOOR_COUNT];
+
+/* API */
+void Door_Init(const DoorConfig *configs, UART_HandleTypeDef *console);
+void Door_Start(void);
+void Door_Poll(void);
+void Door_UartRxCplt(UART_HandleTypeDef *huart);
+void Door_PresenceDetected(uint16_t pin);
+void Console_Write(const char *msg);
+void Console_TxCplt(UART_HandleTypeDef *huart);
+void Audit_Record(uint8_t door, AuditEvent event);
+
+#endif
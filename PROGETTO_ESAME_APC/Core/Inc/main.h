@@ -55,12 +55,17 @@ void HAL_TIM_MspPostInit(TIM_HandleTypeDef *htim);
 void Error_Handler(void);
 
 /* USER CODE BEGIN EFP */
+void Camera_UART_MspInit(UART_HandleTypeDef* huart);
 
 /* USER CODE END EFP */
 
 /* Private defines -----------------------------------------------------------*/
 
 /* USER CODE BEGIN Private defines */
+/* 1 = display OLED SSD1306 collegato su I2C1 (PB6 SCL, PB7 SDA) */
+#ifndef USE_SSD1306
+#define USE_SSD1306 0
+#endif
 
 /* USER CODE END Private defines */
 
@@ -12,6 +12,14 @@
 #define SSD1306_WIDTH 128
 #define SSD1306_HEIGHT 64
 
+/* Tempo di assestamento dopo l'accensione (ms dal reset) */
+#define SSD1306_POWERUP_MS 100
+
+/* Init asincrona: tentativi completi prima di considerare il display assente
+   e attesa tra un tentativo e l'altro dopo un NACK o un errore di bus */
+#define SSD1306_INIT_ATTEMPTS 3
+#define SSD1306_RETRY_MS 100
+
 /* Color definitions */
 typedef enum {
     Black = 0x00,
@@ -24,6 +32,7 @@ typedef struct {
     uint16_t CurrentY;
     uint8_t Inverted;
     uint8_t Initialized;
+    uint32_t I2CError;      // HAL_I2C_GetError dell'ultimo trasferimento fallito dell'init
 } SSD1306_t;
 
 extern I2C_HandleTypeDef hi2c1;
@@ -31,6 +40,10 @@ extern SSD1306_t SSD1306;
 
 /* API */
 void ssd1306_Init(void);
+void ssd1306_InitAsync(void);
+uint8_t ssd1306_Process(void);
+void ssd1306_I2C_TxCplt(I2C_HandleTypeDef *hi2c);
+void ssd1306_I2C_Error(I2C_HandleTypeDef *hi2c);
 void ssd1306_Fill(SSD1306_COLOR color);
 void ssd1306_UpdateScreen(void);
 void ssd1306_DrawPixel(uint8_t x, uint8_t y, SSD1306_COLOR color);
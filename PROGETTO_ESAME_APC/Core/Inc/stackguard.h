@@ -0,0 +1,17 @@
+#ifndef __STACKGUARD_H
+#define __STACKGUARD_H
+
+#include "stm32f3xx_hal.h"
+
+/* Protezione dello stack MSP: sotto lo stack il linker riserva
+ * _Stack_Guard_Size byte che la MPU rende inaccessibili. Un overflow genera
+ * un MemManage fault invece di corrompere heap e .bss in silenzio; il fault
+ * viene contato in RAM .noinit e il micro viene resettato. */
+
+/* API */
+void StackGuard_Init(void);
+uint32_t StackGuard_HighWater(void);
+void StackGuard_Report(void);
+void StackGuard_Fault(void) __attribute__((noreturn));
+
+#endif
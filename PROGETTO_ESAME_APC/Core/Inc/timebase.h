@@ -0,0 +1,25 @@
+#ifndef __TIMEBASE_H
+#define __TIMEBASE_H
+
+#include "stm32f3xx_hal.h"
+
+/* Fasi di avvio misurate dal reset (vedi Boot_Report) */
+typedef enum {
+    BOOT_HAL_INIT,
+    BOOT_CLOCK,
+    BOOT_GPIO,
+    BOOT_BLUETOOTH,     // USART2 pronta: i comandi vengono già accodati
+    BOOT_SERVO,
+    BOOT_CAMERAS,
+    BOOT_READY,         // scheduler in esecuzione
+    BOOT_DISPLAY,       // init asincrona del display completata (se presente)
+    BOOT_PHASE_COUNT
+} BootPhase;
+
+/* API */
+void Timebase_Init(void);
+uint32_t Timebase_Micros(void);
+void Boot_Mark(BootPhase phase);
+void Boot_Report(void);
+
+#endif
@@ -0,0 +1,640 @@
+/* Includes */
+#include "door.h"
+#include "timebase.h"
+#include "stackguard.h"
+#include "string.h"
+#include "stdio.h"
+
+/* Private variables */
+Door doors[DOOR_COUNT];
+static uint8_t next_door = 0; // porta da cui parte il prossimo giro dello scheduler
+
+/* Bluetooth variables (un solo modulo condiviso da tutte le porte) */
+static UART_HandleTypeDef *console_uart;
+static char bt_char;
+static char bt_buffer[BUFFER_SIZE];
+static uint8_t bt_index = 0;
+
+/* Coda di trasmissione Bluetooth: il main scrive, l'ISR di fine trasmissione svuota */
+static uint8_t tx_ring[CONSOLE_TX_SIZE];
+static volatile uint16_t tx_head = 0;
+static volatile uint16_t tx_tail = 0;
+static volatile uint16_t tx_inflight = 0;
+
+/* Registro accessi comune a tutte le porte */
+static AuditEntry audit_log[AUDIT_LOG_SIZE];
+static uint32_t audit_count = 0;
+
+static const char *const audit_names[] = {
+    "BOOT", "ACCESS_REQUEST", "FACE_GRANTED", "FACE_DENIED", "PIN_REQUIRED",
+    "PIN_GRANTED", "PIN_DENIED", "LOCKOUT_END", "CMD_DROPPED", "BUDGET_OVERRUN",
+    "SPEC_PREPARE", "SPEC_CANCEL", "FACE_HEDGE", "FACE_TIMEOUT", "STALE_REPLY"
+};
+
+/* Functions */
+static int strcasecmp_custom(const char *a, const char *b) {
+    while (*a && *b) {
+        char ca = (*a >= 'A' && *a <= 'Z') ? *a + 32 : *a;
+        char cb = (*b >= 'A' && *b <= 'Z') ? *b + 32 : *b;
+        if (ca != cb) return ca - cb;
+        a++; b++;
+    }
+    return *a - *b;
+}
+
+/* 1 se i primi len caratteri di a sono un prefisso (case-insensitive) di b */
+static int strncaseprefix_custom(const char *a, uint8_t len, const char *b) {
+    for (uint8_t i = 0; i < len; i++, b++) {
+        char ca = (a[i] >= 'A' && a[i] <= 'Z') ? a[i] + 32 : a[i];
+        char cb = (*b >= 'A' && *b <= 'Z') ? *b + 32 : *b;
+        if (*b == 0 || ca != cb) return 0;
+    }
+    return 1;
+}
+
+/* ---------------------------------------------------------------- Console */
+
+/* Avvia la trasmissione del prossimo blocco contiguo (IRQ disabilitate o da ISR) */
+static void Console_Kick(void) {
+    if (tx_inflight != 0 || tx_head == tx_tail) return;
+
+    uint16_t len = (tx_head > tx_tail) ? tx_head - tx_tail : CONSOLE_TX_SIZE - tx_tail;
+    tx_inflight = len;
+    if (HAL_UART_Transmit_IT(console_uart, &tx_ring[tx_tail], len) != HAL_OK)
+        tx_inflight = 0;
+}
+
+/* Accoda un messaggio senza bloccare lo scheduler per la durata della trasmissione
+   (a 9600 baud una riga costa ~40 ms che prima venivano rubati a tutte le porte). */
+void Console_Write(const char *msg) {
+    while (*msg) {
+        uint16_t next = (tx_head + 1) % CONSOLE_TX_SIZE;
+        if (next == tx_tail) {
+            // coda piena: attende che l'ISR liberi spazio
+            __disable_irq();
+            Console_Kick();
+            __enable_irq();
+            continue;
+        }
+        tx_ring[tx_head] = (uint8_t)*msg++;
+        tx_head = next;
+    }
+    __disable_irq();
+    Console_Kick();
+    __enable_irq();
+}
+
+void Console_TxCplt(UART_HandleTypeDef *huart) {
+    if (huart != console_uart) return;
+    tx_tail = (tx_tail + tx_inflight) % CONSOLE_TX_SIZE;
+    tx_inflight = 0;
+    Console_Kick();
+}
+
+static void Door_Print(Door *d, const char *msg) {
+#if DOOR_COUNT > 1
+    char prefix[8];
+    snprintf(prefix, sizeof(prefix), "[D%u] ", d->id + 1);
+    Console_Write(prefix);
+#else
+    (void)d;
+#endif
+    Console_Write(msg);
+}
+
+/* ------------------------------------------------------------------ Audit */
+
+void Audit_Record(uint8_t door, AuditEvent event) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    AuditEntry *e = &audit_log[audit_count % AUDIT_LOG_SIZE];
+    e->tick = HAL_GetTick();
+    e->door = door;
+    e->event = (uint8_t)event;
+    audit_count++;
+    __set_PRIMASK(primask);
+}
+
+/* ------------------------------------------------------- Tempi di risposta */
+
+static void Door_RecordLatency(Door *d, uint32_t ms) {
+    if (ms > 0xFFFF) ms = 0xFFFF;
+    d->face_latency[d->face_latency_count % FACE_LATENCY_SAMPLES] = (uint16_t)ms;
+    d->face_latency_count++;
+    if (d->face_latency_count >= 2 * FACE_LATENCY_SAMPLES)
+        d->face_latency_count -= FACE_LATENCY_SAMPLES; // resta "pieno" senza overflow
+}
+
+/* Soglia di hedging: p95 degli ultimi tempi di risposta, limitata tra
+   FACE_HEDGE_MIN_MS e la deadline */
+static uint32_t Door_HedgeThreshold(const Door *d) {
+    uint8_t n = (d->face_latency_count < FACE_LATENCY_SAMPLES) ? d->face_latency_count : FACE_LATENCY_SAMPLES;
+    if (n < FACE_LATENCY_MIN_SAMPLES) return FACE_HEDGE_DEFAULT_MS;
+
+    uint16_t sorted[FACE_LATENCY_SAMPLES];
+    memcpy(sorted, d->face_latency, n * sizeof(uint16_t));
+    for (uint8_t i = 1; i < n; i++) {          // insertion sort, n <= 16
+        uint16_t v = sorted[i];
+        int8_t j = i - 1;
+        while (j >= 0 && sorted[j] > v) { sorted[j + 1] = sorted[j]; j--; }
+        sorted[j + 1] = v;
+    }
+    uint32_t p95 = sorted[(n * 95 + 99) / 100 - 1];
+
+    if (p95 < FACE_HEDGE_MIN_MS) p95 = FACE_HEDGE_MIN_MS;
+    if (p95 >= FACE_RESPONSE_DEADLINE_MS) p95 = FACE_RESPONSE_DEADLINE_MS;
+    return p95;
+}
+
+static void Audit_Dump(void) {
+    char line[64];
+    uint32_t first = (audit_count > AUDIT_LOG_SIZE) ? audit_count - AUDIT_LOG_SIZE : 0;
+
+    for (uint32_t i = first; i < audit_count; i++) {
+        const AuditEntry *e = &audit_log[i % AUDIT_LOG_SIZE];
+        snprintf(line, sizeof(line), "%lu D%u %s\r\n",
+                 (unsigned long)e->tick, e->door + 1, audit_names[e->event]);
+        Console_Write(line);
+    }
+    for (uint8_t i = 0; i < DOOR_COUNT; i++) {
+        snprintf(line, sizeof(line), "D%u MAX LAT %lu ms, OVERRUN %lu, DROP %lu\r\n", i + 1,
+                 (unsigned long)doors[i].max_latency_ms,
+                 (unsigned long)doors[i].budget_overruns,
+                 (unsigned long)doors[i].dropped_cmds);
+        Console_Write(line);
+        snprintf(line, sizeof(line), "D%u WARM-UP HIT %lu, MISS %lu\r\n", i + 1,
+                 (unsigned long)doors[i].spec_hits,
+                 (unsigned long)doors[i].spec_misses);
+        Console_Write(line);
+        snprintf(line, sizeof(line), "D%u FACE HEDGE AT %lu ms, TIMEOUT %d, STALE %lu\r\n", i + 1,
+                 (unsigned long)Door_HedgeThreshold(&doors[i]),
+                 doors[i].face_timeouts,
+                 (unsigned long)doors[i].stale_replies);
+        Console_Write(line);
+    }
+}
+
+/* -------------------------------------------------------------- Hardware */
+
+static void Servo_Move(Door *d, uint16_t pulse_val) {
+    __HAL_TIM_SET_COMPARE(d->cfg->htim, d->cfg->servo_channel, pulse_val);
+}
+
+static void LED_Set(Door *d, GPIO_PinState red, GPIO_PinState green, GPIO_PinState blue) {
+    if (d->cfg->led_port == NULL) return;
+    HAL_GPIO_WritePin(d->cfg->led_port, d->cfg->led_red, red);
+    HAL_GPIO_WritePin(d->cfg->led_port, d->cfg->led_green, green);
+    HAL_GPIO_WritePin(d->cfg->led_port, d->cfg->led_blue, blue);
+}
+
+static void LED_Red(Door *d)   { LED_Set(d, GPIO_PIN_SET, GPIO_PIN_RESET, GPIO_PIN_RESET); }
+static void LED_Green(Door *d) { LED_Set(d, GPIO_PIN_RESET, GPIO_PIN_SET, GPIO_PIN_RESET); }
+static void LED_Blue(Door *d)  { LED_Set(d, GPIO_PIN_RESET, GPIO_PIN_RESET, GPIO_PIN_SET); }
+
+/* ------------------------------------------------------------ Ricezione */
+
+/* Porta a cui è destinata una riga (anche parziale) e inizio del comando */
+static Door *Bluetooth_Target(const char *line, uint8_t len, const char **cmd) {
+    *cmd = line;
+    if (DOOR_COUNT > 1 && len >= 2 && line[1] == ':' &&
+        line[0] >= '1' && line[0] < '1' + DOOR_COUNT) {
+        *cmd = line + 2;
+        return &doors[line[0] - '1'];
+    }
+    return &doors[0];
+}
+
+#if DOOR_SPECULATIVE_WARMUP
+/* Dopo ogni carattere: se la riga può ancora diventare "Access" chiede il
+   warm-up, altrimenti annulla quello eventualmente in corso. */
+static void Bluetooth_Speculate(void) {
+    const char *cmd;
+    Door *d = Bluetooth_Target(bt_buffer, bt_index, &cmd);
+    uint8_t len = bt_index - (uint8_t)(cmd - bt_buffer);
+
+    if (len == 0 || d->access_state != WAIT_ACCESS_COMMAND) return;
+    // una cifra iniziale può essere il prefisso "N:" di un'altra porta
+    if (DOOR_COUNT > 1 && bt_index == 1 && cmd[0] >= '1' && cmd[0] < '1' + DOOR_COUNT) return;
+
+    if (strncaseprefix_custom(cmd, len, "Access")) {
+        if (len == 1) d->spec_req = SPEC_REQ_PREPARE;
+    } else {
+        d->spec_req = SPEC_REQ_CANCEL;
+    }
+}
+#endif
+
+/* Chiamata dall'ISR per ogni carattere Bluetooth: assembla la riga e la
+   consegna alla coda della porta indicata dal prefisso "N:". */
+static void Bluetooth_Rx(char c) {
+    if (c == '\r' || c == '\n') {
+        bt_buffer[bt_index] = 0; /*Aggiunge un terminatore nullo (\0) alla fine della stringa nel buffer.
+                                   Questo trasforma il contenuto di bt_buffer in una stringa C corretta,
+                                   pronta per funzioni come strcmp o strcasecmp.*/
+        uint8_t len = bt_index;
+        bt_index = 0;           /*Resetta l’indice del buffer per il prossimo comando.*/
+        if (len == 0) return;   // "\r\n": la seconda metà del terminatore non è un comando
+
+        const char *cmd;
+        Door *d = Bluetooth_Target(bt_buffer, len, &cmd);
+
+        if ((uint8_t)(d->cmd_head - d->cmd_tail) >= DOOR_CMD_QUEUE_SIZE) {
+            // la porta non ha ancora smaltito i comandi precedenti
+            d->dropped_cmds++;
+            Audit_Record(d->id, AUDIT_CMD_DROPPED);
+            return;
+        }
+        DoorCommand *slot = &d->cmd_queue[d->cmd_head % DOOR_CMD_QUEUE_SIZE];
+        strcpy(slot->text, cmd);
+        slot->tick = HAL_GetTick();
+        d->cmd_head++;
+    }
+    else
+    {
+        bt_buffer[bt_index++] = c;
+        if(bt_index >= sizeof(bt_buffer)) bt_index = 0;
+#if DOOR_SPECULATIVE_WARMUP
+        Bluetooth_Speculate();
+#endif
+    }
+}
+
+/* EXTI callback del sensore di presenza */
+void Door_PresenceDetected(uint16_t pin) {
+#if DOOR_SPECULATIVE_WARMUP
+    for (uint8_t i = 0; i < DOOR_COUNT; i++) {
+        Door *d = &doors[i];
+        if (d->cfg->presence_pin == pin && d->access_state == WAIT_ACCESS_COMMAND)
+            d->spec_req = SPEC_REQ_PREPARE;
+    }
+#else
+    (void)pin;
+#endif
+}
+
+/* UART callback: Bluetooth o camera di una delle porte */
+void Door_UartRxCplt(UART_HandleTypeDef *huart) {
+    if (huart == console_uart) {
+        Bluetooth_Rx(bt_char);
+        HAL_UART_Receive_IT(console_uart, (uint8_t*)&bt_char, 1); // riattiva sempre
+        return;
+    }
+
+    for (uint8_t i = 0; i < DOOR_COUNT; i++) {
+        Door *d = &doors[i];
+        if (huart != d->cfg->cam_uart) continue;
+
+        if ((uint8_t)(d->cam_head - d->cam_tail) < DOOR_CAM_QUEUE_SIZE) {
+            uint8_t slot = d->cam_head % DOOR_CAM_QUEUE_SIZE;
+            d->cam_queue[slot] = d->cam_byte;
+            d->cam_tick[slot] = HAL_GetTick();
+            d->cam_head++;
+        }
+        HAL_UART_Receive_IT(huart, &d->cam_byte, 1); // riattiva sempre
+        return;
+    }
+}
+
+/* ------------------------------------------------------ Macchina a stati */
+
+static void Camera_Send(Door *d, const char *frame) {
+    if (HAL_GetTick() - d->cam_tx_tick >= CAM_WAKE_IDLE_MS) {
+        // la camera puo' dormire: preambolo per svegliarla, poi una riga vuota
+        // che chiude eventuali caratteri ricevuti a meta' durante il risveglio
+        HAL_UART_Transmit(d->cfg->cam_uart, (const uint8_t*)"\n\n\n", 3, 50);
+        HAL_Delay(CAM_WAKE_GUARD_MS);
+        HAL_UART_Transmit(d->cfg->cam_uart, (const uint8_t*)"\n", 1, 50);
+    }
+    HAL_UART_Transmit(d->cfg->cam_uart, (const uint8_t*)frame, strlen(frame), 50);
+    d->cam_tx_tick = HAL_GetTick();
+}
+
+#if DOOR_SPECULATIVE_WARMUP
+static void Door_CancelSpeculation(Door *d) {
+    Camera_Send(d, "C\n");
+    d->spec_active = 0;
+    d->spec_misses++;
+    Audit_Record(d->id, AUDIT_SPEC_CANCEL);
+}
+
+/* Gestisce le richieste di warm-up arrivate dalle ISR e la loro scadenza */
+static void Door_HandleSpeculation(Door *d, uint32_t now) {
+    __disable_irq();
+    uint8_t req = d->spec_req;
+    d->spec_req = SPEC_REQ_NONE;
+    __enable_irq();
+
+    if (req == SPEC_REQ_PREPARE && !d->spec_active && d->access_state == WAIT_ACCESS_COMMAND) {
+        Camera_Send(d, "P\n");
+        d->spec_active = 1;
+        d->spec_tick = now;
+        Audit_Record(d->id, AUDIT_SPEC_PREPARE);
+    }
+    else if (req == SPEC_REQ_CANCEL && d->spec_active) {
+        Door_CancelSpeculation(d);
+    }
+
+    if (d->spec_active && now - d->spec_tick >= SPEC_TIMEOUT_MS)
+        Door_CancelSpeculation(d);
+}
+#endif
+
+static void Door_Grant(Door *d) {
+    LED_Green(d);
+    Servo_Move(d, SERVO_OPEN);
+    d->action_timer = HAL_GetTick(); // memorizza il momento in cui il servo inizia a muoversi
+    d->action_state = 1;
+
+    d->face_attempts = 0;
+    d->access_state = WAIT_ACCESS_COMMAND;
+    Door_Print(d, "ACCESS GRANTED\r\n");
+    d->message_sent = 0;
+}
+
+/* Invia un trigger "2:<id>" con un nuovo ID di richiesta */
+static char Door_SendTrigger(Door *d) {
+    char frame[] = "2:0\n";
+    char last = d->hedge_id ? d->hedge_id : d->req_id;
+    char id = (last >= '0' && last < '9') ? last + 1 : '0';
+
+    frame[2] = id;
+    Camera_Send(d, frame);
+    return id;
+}
+
+/* Comandi diagnostici, validi qualunque sia lo stato della porta che li riceve
+   (anche in lockout); 1 se cmd era uno di questi */
+static int Door_HandleGlobal(const char *cmd) {
+    if (strcasecmp_custom(cmd, "Log") == 0) {
+        Audit_Dump();
+        return 1;
+    }
+    if (strcasecmp_custom(cmd, "Boot") == 0) {
+        Boot_Report();
+        return 1;
+    }
+    if (strcasecmp_custom(cmd, "Mem") == 0) {
+        StackGuard_Report();
+        return 1;
+    }
+    return 0;
+}
+
+static void Door_HandleCommand(Door *d, const char *cmd) {
+    if (d->access_state == WAIT_ACCESS_COMMAND)
+    {
+        if (strcasecmp_custom(cmd, "Access") == 0)
+        {
+            LED_Blue(d);
+            d->req_id = Door_SendTrigger(d);
+            d->hedge_id = 0;
+            d->cam_verdict = 0;
+            d->trigger_tick = HAL_GetTick();
+            if (d->spec_active) {
+                // la camera è già calda: il trigger consuma la speculazione
+                d->spec_active = 0;
+                d->spec_hits++;
+            }
+            d->access_state = WAIT_FACE_RESPONSE;
+            Audit_Record(d->id, AUDIT_ACCESS_REQUEST);
+
+            Door_Print(d, "TRYING FACE RECOGNITION...\r\n");
+            d->message_sent = 0;
+        }
+        else
+        {
+#if DOOR_SPECULATIVE_WARMUP
+            if (d->spec_active) Door_CancelSpeculation(d);
+#endif
+            if (d->message_sent == 0)
+            {
+                Door_Print(d, "WRITE 'ACCESS' TO START FACIAL RECOGNIZE\r\n");
+                d->message_sent = 1;
+            }
+        }
+    }
+    else if (d->access_state == WAIT_PIN)
+    {
+        if (strcmp(cmd, "1234") == 0)
+        {
+            Audit_Record(d->id, AUDIT_PIN_GRANTED);
+            Door_Grant(d);
+        }
+        else
+        {
+            LED_Red(d);
+            Door_Print(d, "ACCESS DENIED. WAIT 10 SECONDS...\r\n");
+            Audit_Record(d->id, AUDIT_PIN_DENIED);
+
+            d->face_attempts = 0;
+            d->access_state = LOCKOUT;
+            d->lockout_timer = HAL_GetTick(); // memorizza il momento in cui è iniziato il lockout
+        }
+    }
+}
+
+static void Door_FaceVerdict(Door *d, char verdict) {
+    d->face_timeouts = 0;
+    Door_RecordLatency(d, HAL_GetTick() - d->trigger_tick);
+
+    if (verdict == 'Y')
+    {
+        Audit_Record(d->id, AUDIT_FACE_GRANTED);
+        Door_Grant(d);
+    }
+    else
+    {
+        d->face_attempts++;
+        Audit_Record(d->id, AUDIT_FACE_DENIED);
+
+        if (d->face_attempts < MAX_FACE_ATTEMPTS)
+        {
+            Door_Print(d, "FACE NOT RECOGNIZED. TRY AGAIN\r\n");
+
+            LED_Red(d);
+            d->action_timer = HAL_GetTick(); // memorizza il momento in cui avviene il fallimento di accesso
+            d->action_state = 2;
+
+            d->access_state = WAIT_ACCESS_COMMAND;
+            d->message_sent = 0;
+        }
+        else
+        {
+            d->access_state = WAIT_PIN;
+            d->face_attempts = 0;
+            Audit_Record(d->id, AUDIT_PIN_REQUIRED);
+
+            Door_Print(d, "MAX ATTEMPTS REACHED. INSERT PIN\r\n");
+
+            LED_Red(d);
+            d->message_sent = 0;
+        }
+    }
+}
+
+/* Risposta della camera: verdetto 'Y'/'N' seguito dall'ID del trigger */
+static void Door_HandleCamera(Door *d, uint8_t cam_byte) {
+    if (cam_byte == 'Y' || cam_byte == 'N') {
+        d->cam_verdict = (char)cam_byte;
+        return;
+    }
+    if (cam_byte < '0' || cam_byte > '9' || d->cam_verdict == 0) return;
+
+    char verdict = d->cam_verdict;
+    d->cam_verdict = 0;
+
+    if (d->access_state == WAIT_FACE_RESPONSE &&
+        (cam_byte == (uint8_t)d->req_id || (d->hedge_id && cam_byte == (uint8_t)d->hedge_id))) {
+        Door_FaceVerdict(d, verdict);
+    } else {
+        // risposta a un trigger già scaduto o già servito dall'altro ramo dell'hedging
+        d->stale_replies++;
+        Audit_Record(d->id, AUDIT_STALE_REPLY);
+    }
+}
+
+/* Hedging e deadline della risposta della camera */
+static void Door_HandleDeadline(Door *d, uint32_t now) {
+    if (d->access_state != WAIT_FACE_RESPONSE) return;
+    uint32_t waited = now - d->trigger_tick;
+
+#if FACE_HEDGE_ENABLED
+    if (d->hedge_id == 0 && waited >= Door_HedgeThreshold(d) && waited < FACE_RESPONSE_DEADLINE_MS) {
+        d->hedge_id = Door_SendTrigger(d);
+        Audit_Record(d->id, AUDIT_FACE_HEDGE);
+    }
+#endif
+
+    if (waited < FACE_RESPONSE_DEADLINE_MS) return;
+
+    d->face_timeouts++;
+    d->req_id = d->hedge_id ? d->hedge_id : d->req_id; // il prossimo trigger userà un ID nuovo
+    d->hedge_id = 0;
+    d->cam_verdict = 0;
+    Audit_Record(d->id, AUDIT_FACE_TIMEOUT);
+    LED_Red(d);
+    d->message_sent = 0;
+
+    if (d->face_timeouts < MAX_FACE_TIMEOUTS)
+    {
+        Door_Print(d, "CAMERA NOT RESPONDING. TRY AGAIN\r\n");
+        d->action_timer = now;
+        d->action_state = 2;
+        d->access_state = WAIT_ACCESS_COMMAND;
+    }
+    else
+    {
+        d->face_timeouts = 0;
+        d->face_attempts = 0;
+        d->access_state = WAIT_PIN;
+        Audit_Record(d->id, AUDIT_PIN_REQUIRED);
+        Door_Print(d, "CAMERA NOT RESPONDING. INSERT PIN\r\n");
+    }
+}
+
+/* gestione servo/LED temporizzati e lockout, senza attese bloccanti */
+static void Door_HandleTimers(Door *d, uint32_t now) {
+    if (d->action_state == 1 && now - d->action_timer >= SERVO_OPEN_TIME)
+    {
+        Servo_Move(d, SERVO_CLOSE);   // apertura inversa per simulare chiusura
+        d->action_timer = now;        // breve pausa per completare il movimento
+        d->action_state = 3;
+    }
+    else if (d->action_state == 3 && now - d->action_timer >= SERVO_CLOSE_TIME)
+    {
+        Servo_Move(d, SERVO_STOP);    // ferma il servo
+        LED_Blue(d);
+        d->action_state = 0;
+    }
+    else if (d->action_state == 2 && now - d->action_timer >= LED_FAIL_TIME)
+    {
+        LED_Blue(d);
+        d->action_state = 0;
+    }
+
+    // gestione lockout
+    if (d->access_state == LOCKOUT && now - d->lockout_timer >= LOCKOUT_TIME)
+    {
+        d->access_state = WAIT_ACCESS_COMMAND;
+        d->message_sent = 0;
+        Audit_Record(d->id, AUDIT_LOCKOUT_END);
+
+        LED_Blue(d);
+        Door_Print(d, "WRITE 'ACCESS' TO START FACIAL RECOGNIZE\r\n");
+    }
+}
+
+static void Door_CheckBudget(Door *d, uint32_t latency) {
+    if (latency > d->max_latency_ms) d->max_latency_ms = latency;
+    if (latency > DOOR_LATENCY_BUDGET_MS) {
+        d->budget_overruns++;
+        Audit_Record(d->id, AUDIT_BUDGET_OVERRUN);
+    }
+}
+
+/* Un passo di servizio per una porta: al massimo un comando Bluetooth e una
+   risposta della camera, cosi' una porta molto attiva non affama le altre. */
+static void Door_Service(Door *d) {
+    uint32_t now = HAL_GetTick();
+
+#if DOOR_SPECULATIVE_WARMUP
+    Door_HandleSpeculation(d, now);
+#endif
+
+    if (d->cmd_head != d->cmd_tail) {
+        DoorCommand *c = &d->cmd_queue[d->cmd_tail % DOOR_CMD_QUEUE_SIZE];
+        Door_CheckBudget(d, now - c->tick);
+        if (!Door_HandleGlobal(c->text) && d->access_state != LOCKOUT)
+            Door_HandleCommand(d, c->text);
+        d->cmd_tail++;
+    }
+
+    if (d->cam_head != d->cam_tail) {
+        uint8_t slot = d->cam_tail % DOOR_CAM_QUEUE_SIZE;
+        Door_CheckBudget(d, now - d->cam_tick[slot]);
+        Door_HandleCamera(d, d->cam_queue[slot]);
+        d->cam_tail++;
+    }
+
+    Door_HandleDeadline(d, now);
+    Door_HandleTimers(d, now);
+}
+
+/* Scheduler round-robin: il punto di partenza ruota ad ogni giro */
+void Door_Poll(void) {
+    for (uint8_t i = 0; i < DOOR_COUNT; i++)
+        Door_Service(&doors[(next_door + i) % DOOR_COUNT]);
+    next_door = (next_door + 1) % DOOR_COUNT;
+}
+
+/* Prima fase dell'avvio: serve solo la USART del Bluetooth. I comandi
+   ricevuti da qui in poi vengono accodati e gestiti dopo Door_Start(). */
+void Door_Init(const DoorConfig *configs, UART_HandleTypeDef *console) {
+    console_uart = console;
+    memset(doors, 0, sizeof(doors));
+
+    for (uint8_t i = 0; i < DOOR_COUNT; i++) {
+        Door *d = &doors[i];
+        d->id = i;
+        d->cfg = &configs[i];
+        d->access_state = WAIT_ACCESS_COMMAND;
+    }
+
+    HAL_UART_Receive_IT(console_uart, (uint8_t*)&bt_char, 1);
+}
+
+/* Seconda fase: servo, LED e camere sono inizializzati */
+void Door_Start(void) {
+    for (uint8_t i = 0; i < DOOR_COUNT; i++) {
+        Door *d = &doors[i];
+
+        HAL_TIM_PWM_Start(d->cfg->htim, d->cfg->servo_channel);
+        Servo_Move(d, SERVO_STOP);
+        LED_Blue(d);
+        HAL_UART_Receive_IT(d->cfg->cam_uart, &d->cam_byte, 1);
+        Audit_Record(i, AUDIT_BOOT);
+    }
+
+    for (uint8_t i = 0; i < DOOR_COUNT; i++)
+        Door_Print(&doors[i], "WRITE 'ACCESS' TO START FACIAL RECOGNIZE\r\n");
+}
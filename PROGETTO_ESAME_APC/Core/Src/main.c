@@ -1,46 +1,46 @@
 /* Includes */
 #include "main.h"
-#include "string.h"
-
-/* Defines */
-#define SERVO_STOP   1400
-#define SERVO_OPEN   1000
-#define SERVO_CLOSE  1000
-#define BUFFER_SIZE 64
-#define MAX_FACE_ATTEMPTS 3
-#define LOCKOUT_TIME 10000 // 10 secondi
-#define SERVO_OPEN_TIME 200
-#define LED_FAIL_TIME 2000
-
-/* Typedef */
-typedef enum {
-    WAIT_ACCESS_COMMAND,
-    WAIT_FACE_RESPONSE,
-    WAIT_PIN,
-    LOCKOUT
-} AccessState;
+#include "door.h"
+#include "timebase.h"
+#include "stackguard.h"
+#if USE_SSD1306
+#include "ssd1306.h"
+#endif
 
 /* Private variables */
 TIM_HandleTypeDef htim1;
 UART_HandleTypeDef huart2;   // Bluetooth
-UART_HandleTypeDef huart3;   // ESP32-CAM
-
-AccessState access_state = WAIT_ACCESS_COMMAND;
-
-/* Bluetooth variables */
-char bt_char;
-char bt_buffer[BUFFER_SIZE];
-uint8_t bt_index = 0;
-
-/* CAM variables */
-uint8_t cam_byte;
-
-/* State management */
-int face_attempts = 0;
-int message_sent = 0;
-uint32_t lockout_timer = 0;
-uint32_t action_timer = 0;
-uint8_t action_state = 0; // 0 idle, 1 success, 2 failure
+UART_HandleTypeDef huart3;   // ESP32-CAM porta 1
+
+/* USER CODE BEGIN PV */
+#if USE_SSD1306
+I2C_HandleTypeDef hi2c1;     // display OLED
+#endif
+#if DOOR_COUNT >= 2
+UART_HandleTypeDef huart1;   // ESP32-CAM porta 2
+#endif
+#if DOOR_COUNT >= 3
+UART_HandleTypeDef huart4;   // ESP32-CAM porta 3
+#endif
+#if DOOR_COUNT >= 4
+UART_HandleTypeDef huart5;   // ESP32-CAM porta 4
+#endif
+
+/* Risorse hardware di ogni porta */
+static const DoorConfig door_config[DOOR_COUNT] = {
+    { &htim1, TIM_CHANNEL_1, &huart3, GPIOA, GPIO_PIN_5, GPIO_PIN_6, GPIO_PIN_7, GPIO_PIN_0 },
+#if DOOR_COUNT >= 2
+    { &htim1, TIM_CHANNEL_2, &huart1, NULL, 0, 0, 0, 0 },
+#endif
+#if DOOR_COUNT >= 3
+    { &htim1, TIM_CHANNEL_3, &huart4, NULL, 0, 0, 0, 0 },
+#endif
+#if DOOR_COUNT >= 4
+    { &htim1, TIM_CHANNEL_4, &huart5, NULL, 0, 0, 0, 0 },
+#endif
+};
+
+/* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
 void SystemClock_Config(void);
@@ -48,223 +48,109 @@ static void MX_GPIO_Init(void);
 static void MX_TIM1_Init(void);
 static void MX_USART2_UART_Init(void);
 static void MX_USART3_UART_Init(void);
-void Servo_Move(uint16_t);
-void LED_Red(void);
-void LED_Green(void);
-void LED_Blue(void);
+/* USER CODE BEGIN PFP */
+#if USE_SSD1306
+static void MX_I2C1_Init(void);
+#endif
+#if DOOR_COUNT >= 2
+static void MX_USART1_UART_Init(void);
+#endif
+#if DOOR_COUNT >= 3
+static void MX_UART4_Init(void);
+#endif
+#if DOOR_COUNT >= 4
+static void MX_UART5_Init(void);
+#endif
 void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart);
-
-/* Functions */
-void Servo_Move(uint16_t pulse_val) {
-    __HAL_TIM_SET_COMPARE(&htim1, TIM_CHANNEL_1, pulse_val);
-}
-
-void LED_Red(void) {
-    HAL_GPIO_WritePin(GPIOA, GPIO_PIN_5, GPIO_PIN_SET);
-    HAL_GPIO_WritePin(GPIOA, GPIO_PIN_6, GPIO_PIN_RESET);
-    HAL_GPIO_WritePin(GPIOA, GPIO_PIN_7, GPIO_PIN_RESET);
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart);
+void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin);
+#if USE_SSD1306
+void HAL_I2C_MasterTxCpltCallback(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c);
+#endif
+/* USER CODE END PFP */
+
+/* USER CODE BEGIN 0 */
+/* UART callback */
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
+{
+    Door_UartRxCplt(huart);
 }
 
-void LED_Green(void) {
-    HAL_GPIO_WritePin(GPIOA, GPIO_PIN_5, GPIO_PIN_RESET);
-    HAL_GPIO_WritePin(GPIOA, GPIO_PIN_6, GPIO_PIN_SET);
-    HAL_GPIO_WritePin(GPIOA, GPIO_PIN_7, GPIO_PIN_RESET);
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+    Console_TxCplt(huart);
 }
 
-void LED_Blue(void) {
-    HAL_GPIO_WritePin(GPIOA, GPIO_PIN_5, GPIO_PIN_RESET);
-    HAL_GPIO_WritePin(GPIOA, GPIO_PIN_6, GPIO_PIN_RESET);
-    HAL_GPIO_WritePin(GPIOA, GPIO_PIN_7, GPIO_PIN_SET);
+/* EXTI callback: sensore di presenza davanti alla porta */
+void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
+{
+    Door_PresenceDetected(GPIO_Pin);
 }
 
-int strcasecmp_custom(const char *a, const char *b) {
-    while (*a && *b) {
-        char ca = (*a >= 'A' && *a <= 'Z') ? *a + 32 : *a;
-        char cb = (*b >= 'A' && *b <= 'Z') ? *b + 32 : *b;
-        if (ca != cb) return ca - cb;
-        a++; b++;
-    }
-    return *a - *b;
+#if USE_SSD1306
+/* I2C callback: avanzamento dell'init asincrona del display */
+void HAL_I2C_MasterTxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+    ssd1306_I2C_TxCplt(hi2c);
 }
 
-/* UART callback */
-void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c)
 {
-    if(huart->Instance == USART2) // Bluetooth
-    {
-        if(access_state != LOCKOUT)
-        {
-            if(bt_char == '\r' || bt_char == '\n')
-            {
-                bt_buffer[bt_index] = 0; /*Aggiunge un terminatore nullo (\0) alla fine della stringa nel buffer.
-                						   Questo trasforma il contenuto di bt_buffer in una stringa C corretta,
-                						   pronta per funzioni come strcmp o strcasecmp.*/
-
-                bt_index = 0;			/*Resetta l’indice del buffer per il prossimo comando.
-                							Significa che il buffer è pronto a ricevere nuovi caratteri dal Bluetooth
-                							 senza sovrascrivere i dati precedenti. */
-
-                if(access_state == WAIT_ACCESS_COMMAND)
-                {
-                    if(strcasecmp_custom(bt_buffer, "Access") == 0)
-                    {
-                        LED_Blue();
-                        uint8_t shoot_cmd[] = "2\n";
-                        HAL_UART_Transmit(&huart3, shoot_cmd, sizeof(shoot_cmd)-1, 50);
-                        access_state = WAIT_FACE_RESPONSE;
-
-                        const char msg[] = "TRYING FACE RECOGNITION...\r\n";
-                        HAL_UART_Transmit(&huart2, (uint8_t*)msg, sizeof(msg)-1, 100);
-                        message_sent = 0;
-                    }
-                    else if(message_sent == 0)
-                    {
-                        const char msg[] = "WRITE 'ACCESS' TO START FACIAL RECOGNIZE\r\n";
-                        HAL_UART_Transmit(&huart2, (uint8_t*)msg, sizeof(msg)-1, 100);
-                        message_sent = 1;
-                    }
-                }
-                else if(access_state == WAIT_PIN)
-                {
-                    if(strcmp(bt_buffer, "1234") == 0)
-                    {
-                        LED_Green();
-                        Servo_Move(SERVO_OPEN);
-                        action_timer = HAL_GetTick(); // memorizza il momento in cui il servo inizia a muoversi
-                        action_state = 1;
-
-                        const char msg[] = "ACCESS GRANTED\r\n";
-                        HAL_UART_Transmit(&huart2, (uint8_t*)msg, sizeof(msg)-1, 100);
-
-                        face_attempts = 0;
-                        access_state = WAIT_ACCESS_COMMAND;
-                        message_sent = 0;
-                    }
-                    else
-                    {
-                        LED_Red();
-                        const char msg[] = "ACCESS DENIED. WAIT 10 SECONDS...\r\n";
-                        HAL_UART_Transmit(&huart2, (uint8_t*)msg, sizeof(msg)-1, 100);
-
-                        face_attempts = 0;
-                        access_state = LOCKOUT;
-                        lockout_timer = HAL_GetTick(); // memorizza il momento in cui è iniziato il lockout
-                    }
-                }
-            }
-            else
-            {
-                bt_buffer[bt_index++] = bt_char;
-                if(bt_index >= sizeof(bt_buffer)) bt_index = 0;
-            }
-        }
-        HAL_UART_Receive_IT(&huart2, &bt_char, 1); // riattiva sempre
-    }
-
-    else if(huart->Instance == USART3) // ESP32-CAM
-    {
-        if(access_state == WAIT_FACE_RESPONSE)
-        {
-            if(cam_byte == 'Y')
-            {
-                LED_Green();
-                Servo_Move(SERVO_OPEN);
-                action_timer = HAL_GetTick(); // memorizza il momento in cui il servo inizia a muoversi
-                action_state = 1;
-
-                face_attempts = 0;
-                access_state = WAIT_ACCESS_COMMAND;
-
-                const char msg[] = "ACCESS GRANTED\r\n";
-                HAL_UART_Transmit(&huart2, (uint8_t*)msg, sizeof(msg)-1, 100);
-                message_sent = 0;
-            }
-            else if(cam_byte == 'N')
-            {
-                face_attempts++;
-
-                if(face_attempts < MAX_FACE_ATTEMPTS)
-                {
-                    const char msg[] = "FACE NOT RECOGNIZED. TRY AGAIN\r\n";
-                    HAL_UART_Transmit(&huart2, (uint8_t*)msg, sizeof(msg)-1, 100);
-
-                    LED_Red();
-                    action_timer = HAL_GetTick(); // memorizza il momento in cui avviene il fallimento di accesso
-                    action_state = 2;
-
-                    access_state = WAIT_ACCESS_COMMAND;
-                    message_sent = 0;
-                }
-                else
-                {
-                    access_state = WAIT_PIN;
-                    face_attempts = 0;
-
-                    const char msg[] = "MAX ATTEMPTS REACHED. INSERT PIN\r\n";
-                    HAL_UART_Transmit(&huart2, (uint8_t*)msg, sizeof(msg)-1, 100);
-
-                    LED_Red();
-                    message_sent = 0;
-                }
-            }
-        }
-        HAL_UART_Receive_IT(&huart3, &cam_byte, 1); // riattiva sempre
-    }
+    ssd1306_I2C_Error(hi2c);
 }
+#endif
+/* USER CODE END 0 */
 
 /* Main */
 int main(void)
 {
+    StackGuard_Init();
+    Timebase_Init();
     HAL_Init();
+    Boot_Mark(BOOT_HAL_INIT);
     SystemClock_Config();
+    Boot_Mark(BOOT_CLOCK);
     MX_GPIO_Init();
-    MX_TIM1_Init();
-    MX_USART2_UART_Init();
-    MX_USART3_UART_Init();
+    Boot_Mark(BOOT_GPIO);
 
-    HAL_TIM_PWM_Start(&htim1, TIM_CHANNEL_1);
-    Servo_Move(SERVO_STOP);
-    LED_Blue();
-
-    HAL_UART_Receive_IT(&huart2, &bt_char, 1);
-    HAL_UART_Receive_IT(&huart3, &cam_byte, 1);
+    // il Bluetooth per primo: i comandi vengono accodati mentre il resto si inizializza
+    MX_USART2_UART_Init();
+    Door_Init(door_config, &huart2);
+    Boot_Mark(BOOT_BLUETOOTH);
 
-    const char msg[] = "WRITE 'ACCESS' TO START FACIAL RECOGNIZE\r\n";
-    HAL_UART_Transmit(&huart2, (uint8_t*)msg, sizeof(msg)-1, 100);
+    MX_TIM1_Init();
+    Boot_Mark(BOOT_SERVO);
+    MX_USART3_UART_Init();
+#if DOOR_COUNT >= 2
+    MX_USART1_UART_Init();
+#endif
+#if DOOR_COUNT >= 3
+    MX_UART4_Init();
+#endif
+#if DOOR_COUNT >= 4
+    MX_UART5_Init();
+#endif
+    Boot_Mark(BOOT_CAMERAS);
+
+#if USE_SSD1306
+    // il display si inizializza in background, senza ritardare l'apertura della porta
+    MX_I2C1_Init();
+    ssd1306_InitAsync();
+#endif
+
+    Door_Start();
+    Boot_Mark(BOOT_READY);
 
     while(1)
     {
-        // gestione servo/LED temporizzati
-    	if(action_state == 1 && HAL_GetTick() - action_timer >= SERVO_OPEN_TIME)
-    	{
-    	    Servo_Move(SERVO_CLOSE);   // apertura inversa per simulare chiusura
-    	    HAL_Delay(200);             // breve pausa per completare il movimento
-    	    Servo_Move(SERVO_STOP);    // ferma il servo
-    	    LED_Blue();
-    	    action_state = 0;
-    	}
-
-
-        else if(action_state == 2 && HAL_GetTick() - action_timer >= LED_FAIL_TIME)
-        {
-            LED_Blue();
-            action_state = 0;
-        }
-
-        // gestione lockout
-        if(access_state == LOCKOUT)
-        {
-            if(HAL_GetTick() - lockout_timer >= LOCKOUT_TIME)
-            {
-                access_state = WAIT_ACCESS_COMMAND;
-                message_sent = 0;
-
-                LED_Blue();
-
-                const char msg2[] = "WRITE 'ACCESS' TO START FACIAL RECOGNIZE\r\n";
-                HAL_UART_Transmit(&huart2, (uint8_t*)msg2, sizeof(msg2)-1, 100);
-            }
-        }
+        // un giro dello scheduler: ogni porta riceve un passo di servizio
+        Door_Poll();
+
+#if USE_SSD1306
+        if (!SSD1306.Initialized && ssd1306_Process())
+            Boot_Mark(BOOT_DISPLAY);
+#endif
     }
 }
 
@@ -391,6 +277,25 @@ static void MX_TIM1_Init(void)
     Error_Handler();
   }
   /* USER CODE BEGIN TIM1_Init 2 */
+  /* servo delle porte aggiuntive, stessa configurazione del canale 1 */
+#if DOOR_COUNT >= 2
+  if (HAL_TIM_PWM_ConfigChannel(&htim1, &sConfigOC, TIM_CHANNEL_2) != HAL_OK)
+  {
+    Error_Handler();
+  }
+#endif
+#if DOOR_COUNT >= 3
+  if (HAL_TIM_PWM_ConfigChannel(&htim1, &sConfigOC, TIM_CHANNEL_3) != HAL_OK)
+  {
+    Error_Handler();
+  }
+#endif
+#if DOOR_COUNT >= 4
+  if (HAL_TIM_PWM_ConfigChannel(&htim1, &sConfigOC, TIM_CHANNEL_4) != HAL_OK)
+  {
+    Error_Handler();
+  }
+#endif
 
   /* USER CODE END TIM1_Init 2 */
   HAL_TIM_MspPostInit(&htim1);
@@ -494,11 +399,125 @@ static void MX_GPIO_Init(void)
   HAL_GPIO_Init(GPIOA, &GPIO_InitStruct);
 
   /* USER CODE BEGIN MX_GPIO_Init_2 */
+  /*Configure GPIO pin : PA0 (sensore di presenza porta 1, pulsante USER sulla Discovery) */
+  GPIO_InitStruct.Pin = GPIO_PIN_0;
+  GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING;
+  GPIO_InitStruct.Pull = GPIO_NOPULL;
+  HAL_GPIO_Init(GPIOA, &GPIO_InitStruct);
+
+  /* EXTI interrupt init*/
+  HAL_NVIC_SetPriority(EXTI0_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(EXTI0_IRQn);
 
   /* USER CODE END MX_GPIO_Init_2 */
 }
 
 /* USER CODE BEGIN 4 */
+#if DOOR_COUNT >= 2
+/**
+  * @brief USART1 Initialization Function
+  * @param None
+  * @retval None
+  */
+static void MX_USART1_UART_Init(void)
+{
+  huart1.Instance = USART1;
+  huart1.Init.BaudRate = 115200;
+  huart1.Init.WordLength = UART_WORDLENGTH_8B;
+  huart1.Init.StopBits = UART_STOPBITS_1;
+  huart1.Init.Parity = UART_PARITY_NONE;
+  huart1.Init.Mode = UART_MODE_TX_RX;
+  huart1.Init.HwFlowCtl = UART_HWCONTROL_NONE;
+  huart1.Init.OverSampling = UART_OVERSAMPLING_16;
+  huart1.Init.OneBitSampling = UART_ONE_BIT_SAMPLE_DISABLE;
+  huart1.AdvancedInit.AdvFeatureInit = UART_ADVFEATURE_NO_INIT;
+  Camera_UART_MspInit(&huart1);
+  if (HAL_UART_Init(&huart1) != HAL_OK)
+  {
+    Error_Handler();
+  }
+}
+#endif
+
+#if DOOR_COUNT >= 3
+/**
+  * @brief UART4 Initialization Function
+  * @param None
+  * @retval None
+  */
+static void MX_UART4_Init(void)
+{
+  huart4.Instance = UART4;
+  huart4.Init.BaudRate = 115200;
+  huart4.Init.WordLength = UART_WORDLENGTH_8B;
+  huart4.Init.StopBits = UART_STOPBITS_1;
+  huart4.Init.Parity = UART_PARITY_NONE;
+  huart4.Init.Mode = UART_MODE_TX_RX;
+  huart4.Init.HwFlowCtl = UART_HWCONTROL_NONE;
+  huart4.Init.OverSampling = UART_OVERSAMPLING_16;
+  huart4.Init.OneBitSampling = UART_ONE_BIT_SAMPLE_DISABLE;
+  huart4.AdvancedInit.AdvFeatureInit = UART_ADVFEATURE_NO_INIT;
+  Camera_UART_MspInit(&huart4);
+  if (HAL_UART_Init(&huart4) != HAL_OK)
+  {
+    Error_Handler();
+  }
+}
+#endif
+
+#if DOOR_COUNT >= 4
+/**
+  * @brief UART5 Initialization Function
+  * @param None
+  * @retval None
+  */
+static void MX_UART5_Init(void)
+{
+  huart5.Instance = UART5;
+  huart5.Init.BaudRate = 115200;
+  huart5.Init.WordLength = UART_WORDLENGTH_8B;
+  huart5.Init.StopBits = UART_STOPBITS_1;
+  huart5.Init.Parity = UART_PARITY_NONE;
+  huart5.Init.Mode = UART_MODE_TX_RX;
+  huart5.Init.HwFlowCtl = UART_HWCONTROL_NONE;
+  huart5.Init.OverSampling = UART_OVERSAMPLING_16;
+  huart5.Init.OneBitSampling = UART_ONE_BIT_SAMPLE_DISABLE;
+  huart5.AdvancedInit.AdvFeatureInit = UART_ADVFEATURE_NO_INIT;
+  Camera_UART_MspInit(&huart5);
+  if (HAL_UART_Init(&huart5) != HAL_OK)
+  {
+    Error_Handler();
+  }
+}
+#endif
+
+#if USE_SSD1306
+/**
+  * @brief I2C1 Initialization Function (display OLED, fast mode 400 kHz)
+  * @param None
+  * @retval None
+  */
+static void MX_I2C1_Init(void)
+{
+  hi2c1.Instance = I2C1;
+  hi2c1.Init.Timing = 0x0000020B;
+  hi2c1.Init.OwnAddress1 = 0;
+  hi2c1.Init.AddressingMode = I2C_ADDRESSINGMODE_7BIT;
+  hi2c1.Init.DualAddressMode = I2C_DUALADDRESS_DISABLE;
+  hi2c1.Init.OwnAddress2 = 0;
+  hi2c1.Init.OwnAddress2Masks = I2C_OA2_NOMASK;
+  hi2c1.Init.GeneralCallMode = I2C_GENERALCALL_DISABLE;
+  hi2c1.Init.NoStretchMode = I2C_NOSTRETCH_DISABLE;
+  if (HAL_I2C_Init(&hi2c1) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  if (HAL_I2CEx_ConfigAnalogFilter(&hi2c1, I2C_ANALOGFILTER_ENABLE) != HAL_OK)
+  {
+    Error_Handler();
+  }
+}
+#endif
 
 /* USER CODE END 4 */
 
@@ -3,60 +3,77 @@
 
 extern I2C_HandleTypeDef hi2c1;  // permette a ssd1306 di usare l'I2C
 
-/* Display buffer */
-static uint8_t SSD1306_Buffer[SSD1306_WIDTH * SSD1306_HEIGHT / 8];
+/* Display buffer: il primo byte è il control byte dei dati (0x40), così
+   l'intero frame parte con una sola transazione I2C senza copie sullo stack */
+#define SSD1306_BUFFER_SIZE (SSD1306_WIDTH * SSD1306_HEIGHT / 8)
+static uint8_t SSD1306_Frame[1 + SSD1306_BUFFER_SIZE] = { 0x40 };
+#define SSD1306_Buffer (SSD1306_Frame + 1)
 SSD1306_t SSD1306;
 
-/* Send command to OLED */
-static void ssd1306_WriteCommand(uint8_t command) {
-    uint8_t data[2];
-    data[0] = 0x00; // Control byte for command
-    data[1] = command;
-    HAL_I2C_Master_Transmit(&hi2c1, SSD1306_I2C_ADDR, data, 2, HAL_MAX_DELAY);
-}
+/* Sequenza di init in un unico stream: il control byte 0x00 (Co=0, D/C#=0)
+   indica che tutti i byte successivi sono comandi */
+static const uint8_t ssd1306_init_seq[] = {
+    0x00,
+    0xAE,       // display off
+    0x20, 0x00, // Set Memory Addressing Mode: Horizontal Addressing Mode
+    0xB0,       // Set Page Start Address
+    0xC8,       // COM Output Scan Direction
+    0x00,       // Low column address
+    0x10,       // High column address
+    0x40,       // start line address
+    0x81, 0xFF, // set contrast control register
+    0xA1,       // segment re-map 0 to 127
+    0xA6,       // normal display
+    0xA8, 0x3F, // set multiplex ratio
+    0xA4,       // display follows RAM content
+    0xD3, 0x00, // display offset
+    0xD5, 0xF0, // set display clock divide ratio
+    0xD9, 0x22, // pre-charge period
+    0xDA, 0x12, // com pins hardware configuration
+    0xDB, 0x20, // vcomh
+    0x8D, 0x14, // charge pump
+    0xAF        // display ON
+};
 
-/* Send data to OLED */
-static void ssd1306_WriteData(uint8_t* buffer, size_t buff_size) {
-    uint8_t data[SSD1306_WIDTH + 1];
-    data[0] = 0x40;
-    for (size_t i = 0; i < buff_size; i++) {
-        data[1 + i] = buffer[i];
-    }
-    HAL_I2C_Master_Transmit(&hi2c1, SSD1306_I2C_ADDR, data, buff_size + 1, HAL_MAX_DELAY);
+/* Finestra colonne 0..127, pagine 0..7: in modalità orizzontale il frame
+   da 1024 byte riempie il display con un solo trasferimento */
+static const uint8_t ssd1306_window_seq[] = {
+    0x00,
+    0x21, 0x00, SSD1306_WIDTH - 1,
+    0x22, 0x00, SSD1306_HEIGHT / 8 - 1
+};
+
+/* Passi dell'inizializzazione asincrona */
+static const struct {
+    const uint8_t *buf;
+    uint16_t len;
+} ssd1306_init_steps[] = {
+    { ssd1306_init_seq, sizeof(ssd1306_init_seq) },
+    { ssd1306_window_seq, sizeof(ssd1306_window_seq) },
+    { SSD1306_Frame, sizeof(SSD1306_Frame) },
+};
+static uint8_t ssd1306_step = 0xFF; // 0xFF = init asincrona non avviata o abbandonata
+static uint8_t ssd1306_attempts = 0;
+static uint32_t ssd1306_retry_at = 0;
+
+/* Esito del trasferimento avviato da ssd1306_Process, scritto dalle callback I2C */
+typedef enum {
+    SSD1306_XFER_IDLE,
+    SSD1306_XFER_BUSY,
+    SSD1306_XFER_DONE,
+    SSD1306_XFER_ERROR
+} SSD1306_Xfer;
+static volatile SSD1306_Xfer ssd1306_xfer = SSD1306_XFER_IDLE;
+
+static void ssd1306_Transmit(const uint8_t *buf, uint16_t len) {
+    HAL_I2C_Master_Transmit(&hi2c1, SSD1306_I2C_ADDR, (uint8_t*)buf, len, HAL_MAX_DELAY);
 }
 
-/* Initialize display */
+/* Initialize display (bloccante) */
 void ssd1306_Init(void) {
     HAL_Delay(100);
 
-    ssd1306_WriteCommand(0xAE); // display off
-    ssd1306_WriteCommand(0x20); // Set Memory Addressing Mode
-    ssd1306_WriteCommand(0x00); // Horizontal Addressing Mode
-    ssd1306_WriteCommand(0xB0); // Set Page Start Address
-    ssd1306_WriteCommand(0xC8); // COM Output Scan Direction
-    ssd1306_WriteCommand(0x00); // Low column address
-    ssd1306_WriteCommand(0x10); // High column address
-    ssd1306_WriteCommand(0x40); // start line address
-    ssd1306_WriteCommand(0x81); // set contrast control register
-    ssd1306_WriteCommand(0xFF);
-    ssd1306_WriteCommand(0xA1); // segment re-map 0 to 127
-    ssd1306_WriteCommand(0xA6); // normal display
-    ssd1306_WriteCommand(0xA8); // set multiplex ratio
-    ssd1306_WriteCommand(0x3F);
-    ssd1306_WriteCommand(0xA4); // display follows RAM content
-    ssd1306_WriteCommand(0xD3); // display offset
-    ssd1306_WriteCommand(0x00);
-    ssd1306_WriteCommand(0xD5); // set display clock divide ratio
-    ssd1306_WriteCommand(0xF0);
-    ssd1306_WriteCommand(0xD9); // pre-charge period
-    ssd1306_WriteCommand(0x22);
-    ssd1306_WriteCommand(0xDA); // com pins hardware configuration
-    ssd1306_WriteCommand(0x12);
-    ssd1306_WriteCommand(0xDB); // vcomh
-    ssd1306_WriteCommand(0x20);
-    ssd1306_WriteCommand(0x8D); // charge pump
-    ssd1306_WriteCommand(0x14);
-    ssd1306_WriteCommand(0xAF); // display ON
+    ssd1306_Transmit(ssd1306_init_seq, sizeof(ssd1306_init_seq));
 
     ssd1306_Fill(Black);
     ssd1306_UpdateScreen();
@@ -66,19 +83,88 @@ void ssd1306_Init(void) {
     SSD1306.Initialized = 1;
 }
 
+/* Avvia l'inizializzazione senza bloccare: il lavoro viene fatto da
+   ssd1306_Process(), da chiamare nel ciclo principale */
+void ssd1306_InitAsync(void) {
+    SSD1306.CurrentX = 0;
+    SSD1306.CurrentY = 0;
+    SSD1306.Initialized = 0;
+    SSD1306.I2CError = HAL_I2C_ERROR_NONE;
+    ssd1306_Fill(Black);
+    ssd1306_xfer = SSD1306_XFER_IDLE;
+    ssd1306_attempts = 0;
+    ssd1306_retry_at = SSD1306_POWERUP_MS; // il display richiede ~100 ms dall'accensione: si contano dal reset
+    ssd1306_step = 0;
+}
+
+/* Ritorna 1 quando il display è pronto. Un passo conta solo quando il
+   trasferimento è completato (ACK di tutti i byte): dopo un NACK o un errore
+   di bus la sequenza riparte dall'inizio, e dopo SSD1306_INIT_ATTEMPTS
+   tentativi il display è considerato assente e Initialized resta a 0. */
+uint8_t ssd1306_Process(void) {
+    if (SSD1306.Initialized || ssd1306_step == 0xFF) return SSD1306.Initialized;
+
+    switch (ssd1306_xfer) {
+    case SSD1306_XFER_BUSY:
+        return 0;
+    case SSD1306_XFER_DONE:
+        ssd1306_xfer = SSD1306_XFER_IDLE;
+        ssd1306_step++;
+        break;
+    case SSD1306_XFER_ERROR:
+        ssd1306_xfer = SSD1306_XFER_IDLE;
+        if (++ssd1306_attempts >= SSD1306_INIT_ATTEMPTS) {
+            ssd1306_step = 0xFF;        // nessun display: si smette di occupare il bus
+            return 0;
+        }
+        ssd1306_step = 0;
+        ssd1306_retry_at = HAL_GetTick() + SSD1306_RETRY_MS;
+        return 0;
+    default:
+        break;
+    }
+
+    if ((int32_t)(HAL_GetTick() - ssd1306_retry_at) < 0) return 0;
+
+    if (ssd1306_step < sizeof(ssd1306_init_steps) / sizeof(ssd1306_init_steps[0])) {
+        if (HAL_I2C_GetState(&hi2c1) != HAL_I2C_STATE_READY) return 0;
+        ssd1306_xfer = SSD1306_XFER_BUSY;
+        if (HAL_I2C_Master_Transmit_IT(&hi2c1, SSD1306_I2C_ADDR,
+                                       (uint8_t*)ssd1306_init_steps[ssd1306_step].buf,
+                                       ssd1306_init_steps[ssd1306_step].len) != HAL_OK) {
+            SSD1306.I2CError = HAL_I2C_GetError(&hi2c1);
+            ssd1306_xfer = SSD1306_XFER_ERROR;
+        }
+        return 0;
+    }
+
+    SSD1306.Initialized = 1;
+    return 1;
+}
+
+/* Da HAL_I2C_MasterTxCpltCallback: il passo in corso è stato trasmesso */
+void ssd1306_I2C_TxCplt(I2C_HandleTypeDef *hi2c) {
+    if (hi2c == &hi2c1 && ssd1306_xfer == SSD1306_XFER_BUSY)
+        ssd1306_xfer = SSD1306_XFER_DONE;
+}
+
+/* Da HAL_I2C_ErrorCallback: NACK (display assente o non pronto) o errore di bus */
+void ssd1306_I2C_Error(I2C_HandleTypeDef *hi2c) {
+    if (hi2c == &hi2c1 && ssd1306_xfer == SSD1306_XFER_BUSY) {
+        SSD1306.I2CError = HAL_I2C_GetError(hi2c);
+        ssd1306_xfer = SSD1306_XFER_ERROR;
+    }
+}
+
 /* Fill buffer with color */
 void ssd1306_Fill(SSD1306_COLOR color) {
-    memset(SSD1306_Buffer, (color == Black) ? 0x00 : 0xFF, sizeof(SSD1306_Buffer));
+    memset(SSD1306_Buffer, (color == Black) ? 0x00 : 0xFF, SSD1306_BUFFER_SIZE);
 }
 
 /* Update entire screen */
 void ssd1306_UpdateScreen(void) {
-    for (uint8_t i = 0; i < 8; i++) {
-        ssd1306_WriteCommand(0xB0 + i);
-        ssd1306_WriteCommand(0x00);
-        ssd1306_WriteCommand(0x10);
-        ssd1306_WriteData(&SSD1306_Buffer[SSD1306_WIDTH * i], SSD1306_WIDTH);
-    }
+    ssd1306_Transmit(ssd1306_window_seq, sizeof(ssd1306_window_seq));
+    ssd1306_Transmit(SSD1306_Frame, sizeof(SSD1306_Frame));
 }
 
 /* Draw pixel */
@@ -0,0 +1,93 @@
+/* Includes */
+#include "stackguard.h"
+#include "door.h"
+#include "stdio.h"
+
+/* Simboli del linker script */
+extern uint8_t _sstack_guard;
+extern uint8_t _Stack_Guard_Size;
+extern uint8_t _estack;
+
+#define STACK_PAINT 0xA5A5A5A5U
+#define STACK_GUARD_MAGIC 0x53544B47U   // "STKG"
+#define STACK_PAINT_MARGIN 64           // byte lasciati intatti sotto lo SP corrente
+
+#define GUARD_BASE ((uint32_t)&_sstack_guard)
+#define GUARD_SIZE ((uint32_t)&_Stack_Guard_Size)
+#define STACK_BOTTOM (GUARD_BASE + GUARD_SIZE)
+#define STACK_TOP ((uint32_t)&_estack)
+
+/* Non azzerata dallo startup: sopravvive al reset generato dal fault */
+static struct {
+    uint32_t magic;
+    uint32_t trips;
+    uint32_t last_addr;                 // indirizzo che ha causato l'ultimo overflow
+} guard_state __attribute__((section(".noinit")));
+
+/* Dipinge lo stack libero (per la misura del picco) e attiva la regione MPU.
+   Va chiamata per prima in main(), quando lo stack è quasi vuoto. */
+void StackGuard_Init(void) {
+    if (guard_state.magic != STACK_GUARD_MAGIC) {
+        guard_state.magic = STACK_GUARD_MAGIC;
+        guard_state.trips = 0;
+        guard_state.last_addr = 0;
+    }
+
+    uint32_t *p = (uint32_t *)STACK_BOTTOM;
+    uint32_t *end = (uint32_t *)(__get_MSP() - STACK_PAINT_MARGIN);
+    while (p < end) *p++ = STACK_PAINT;
+
+    /* Regione 0: nessun accesso, nemmeno in esecuzione. Dimensione da
+       _Stack_Guard_Size nel linker script (potenza di 2 e allineamento
+       verificati da ASSERT): MPU_REGION_SIZE_xB vale log2(x) - 1. */
+    MPU_Region_InitTypeDef region = {0};
+    HAL_MPU_Disable();
+    region.Enable = MPU_REGION_ENABLE;
+    region.Number = MPU_REGION_NUMBER0;
+    region.BaseAddress = GUARD_BASE;
+    region.Size = (uint8_t)(30U - __CLZ(GUARD_SIZE));
+    region.SubRegionDisable = 0x00;
+    region.TypeExtField = MPU_TEX_LEVEL0;
+    region.AccessPermission = MPU_REGION_NO_ACCESS;
+    region.DisableExec = MPU_INSTRUCTION_ACCESS_DISABLE;
+    region.IsShareable = MPU_ACCESS_NOT_SHAREABLE;
+    region.IsCacheable = MPU_ACCESS_NOT_CACHEABLE;
+    region.IsBufferable = MPU_ACCESS_NOT_BUFFERABLE;
+    HAL_MPU_ConfigRegion(&region);
+
+    // il resto della memoria mantiene la mappa di default
+    HAL_MPU_Enable(MPU_PRIVILEGED_DEFAULT);
+    SCB->SHCSR |= SCB_SHCSR_MEMFAULTENA_Msk;
+}
+
+/* Byte di stack usati al massimo dall'avvio (prima parola non più dipinta) */
+uint32_t StackGuard_HighWater(void) {
+    const uint32_t *p = (const uint32_t *)STACK_BOTTOM;
+    while ((uint32_t)p < STACK_TOP && *p == STACK_PAINT) p++;
+    return STACK_TOP - (uint32_t)p;
+}
+
+void StackGuard_Report(void) {
+    char line[64];
+
+    snprintf(line, sizeof(line), "STACK PEAK %lu / %lu BYTES\r\n",
+             (unsigned long)StackGuard_HighWater(), (unsigned long)(STACK_TOP - STACK_BOTTOM));
+    Console_Write(line);
+    snprintf(line, sizeof(line), "STACK OVERFLOWS %lu (LAST ADDR 0x%08lX)\r\n",
+             (unsigned long)guard_state.trips, (unsigned long)guard_state.last_addr);
+    Console_Write(line);
+}
+
+/* Chiamata da MemManage_Handler dopo aver riportato MSP a _estack:
+   il contesto interrotto è perso, si registra l'evento e si riparte. */
+void StackGuard_Fault(void) {
+    uint32_t cfsr = SCB->CFSR;
+    uint32_t addr = (cfsr & SCB_CFSR_MMARVALID_Msk) ? SCB->MMFAR : 0;
+
+    // MSTKERR: lo stack è finito nella guardia durante l'ingresso in un interrupt
+    if ((cfsr & SCB_CFSR_MSTKERR_Msk) || (addr >= GUARD_BASE && addr < STACK_BOTTOM)) {
+        guard_state.trips++;
+        guard_state.last_addr = addr;
+    }
+    NVIC_SystemReset();
+}
@@ -22,6 +22,7 @@
 #include "stm32f3xx_it.h"
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
+#include "door.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -59,6 +60,18 @@ extern TIM_HandleTypeDef htim1;
 extern UART_HandleTypeDef huart2;
 extern UART_HandleTypeDef huart3;
 /* USER CODE BEGIN EV */
+#if DOOR_COUNT >= 2
+extern UART_HandleTypeDef huart1;
+#endif
+#if DOOR_COUNT >= 3
+extern UART_HandleTypeDef huart4;
+#endif
+#if DOOR_COUNT >= 4
+extern UART_HandleTypeDef huart5;
+#endif
+#if USE_SSD1306
+extern I2C_HandleTypeDef hi2c1;
+#endif
 
 /* USER CODE END EV */
 
@@ -98,16 +111,17 @@ void HardFault_Handler(void)
 /**
   * @brief This function handles Memory management fault.
   */
-void MemManage_Handler(void)
+__attribute__((naked)) void MemManage_Handler(void)
 {
   /* USER CODE BEGIN MemoryManagement_IRQn 0 */
-
+  /* Lo SP può essere dentro la regione di guardia: si riparte da _estack
+     prima di eseguire codice C che salverebbe registri sullo stack */
+  __asm volatile (
+      "ldr r0, =_estack      \n"
+      "msr msp, r0           \n"
+      "b StackGuard_Fault    \n"
+  );
   /* USER CODE END MemoryManagement_IRQn 0 */
-  while (1)
-  {
-    /* USER CODE BEGIN W1_MemoryManagement_IRQn 0 */
-    /* USER CODE END W1_MemoryManagement_IRQn 0 */
-  }
 }
 
 /**
@@ -243,5 +257,59 @@ void USART3_IRQHandler(void)
 }
 
 /* USER CODE BEGIN 1 */
+/**
+  * @brief This function handles EXTI line0 interrupt (sensore di presenza porta 1).
+  */
+void EXTI0_IRQHandler(void)
+{
+  HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_0);
+}
+
+#if DOOR_COUNT >= 2
+/**
+  * @brief This function handles USART1 global interrupt (camera porta 2).
+  */
+void USART1_IRQHandler(void)
+{
+  HAL_UART_IRQHandler(&huart1);
+}
+#endif
+
+#if DOOR_COUNT >= 3
+/**
+  * @brief This function handles UART4 global interrupt (camera porta 3).
+  */
+void UART4_IRQHandler(void)
+{
+  HAL_UART_IRQHandler(&huart4);
+}
+#endif
+
+#if DOOR_COUNT >= 4
+/**
+  * @brief This function handles UART5 global interrupt (camera porta 4).
+  */
+void UART5_IRQHandler(void)
+{
+  HAL_UART_IRQHandler(&huart5);
+}
+#endif
+
+#if USE_SSD1306
+/**
+  * @brief This function handles I2C1 event interrupt (display OLED).
+  */
+void I2C1_EV_IRQHandler(void)
+{
+  HAL_I2C_EV_IRQHandler(&hi2c1);
+}
 
+/**
+  * @brief This function handles I2C1 error interrupt (display OLED).
+  */
+void I2C1_ER_IRQHandler(void)
+{
+  HAL_I2C_ER_IRQHandler(&hi2c1);
+}
+#endif
 /* USER CODE END 1 */
@@ -0,0 +1,59 @@
+/* Includes */
+#include "timebase.h"
+#include "door.h"
+#include "stdio.h"
+
+/* Base dei tempi in microsecondi sul contatore di cicli DWT->CYCCNT.
+   La frequenza cambia durante l'avvio (HSI 8 MHz -> PLL 64 MHz), quindi i cicli
+   vengono convertiti a ogni chiamata con il SystemCoreClock del momento e
+   accumulati. Va chiamata dal solo contesto main, almeno una volta ogni
+   ~60 s (overflow di CYCCNT a 64 MHz). */
+static uint32_t last_cycles = 0;
+static uint32_t micros_acc = 0;
+
+static uint32_t boot_us[BOOT_PHASE_COUNT];
+static uint8_t boot_marked = 0;   // bitmap delle fasi registrate
+
+static const char *const boot_names[BOOT_PHASE_COUNT] = {
+    "HAL_INIT", "CLOCK", "GPIO", "BLUETOOTH", "SERVO", "CAMERAS", "READY", "DISPLAY"
+};
+
+void Timebase_Init(void) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    last_cycles = 0;
+    micros_acc = 0;
+}
+
+uint32_t Timebase_Micros(void) {
+    uint32_t now = DWT->CYCCNT;
+    uint32_t mhz = SystemCoreClock / 1000000U;
+    uint32_t delta = now - last_cycles;
+
+    micros_acc += delta / mhz;
+    last_cycles = now - (delta % mhz); // i cicli residui restano per la prossima chiamata
+    return micros_acc;
+}
+
+void Boot_Mark(BootPhase phase) {
+    boot_us[phase] = Timebase_Micros();
+    boot_marked |= (1U << phase);
+}
+
+/* Stampa via Bluetooth i tempi di ogni fase e il totale reset -> pronto.
+   Il codice di startup prima di main() (copia .data/.bss) non è incluso. */
+void Boot_Report(void) {
+    char line[48];
+    uint32_t prev = 0;
+
+    for (uint8_t i = 0; i < BOOT_PHASE_COUNT; i++) {
+        if (!(boot_marked & (1U << i))) continue;
+        snprintf(line, sizeof(line), "BOOT %-9s %7lu us (+%lu)\r\n", boot_names[i],
+                 (unsigned long)boot_us[i], (unsigned long)(boot_us[i] - prev));
+        Console_Write(line);
+        if (i != BOOT_DISPLAY) prev = boot_us[i];
+    }
+    snprintf(line, sizeof(line), "RESET TO READY: %lu us\r\n", (unsigned long)boot_us[BOOT_READY]);
+    Console_Write(line);
+}
@@ -0,0 +1,481 @@
+/* Prova su Linux della macchina a stati di door.c: i caratteri Bluetooth e le
+ * risposte della camera entrano da Door_UartRxCplt come dall'ISR, il tempo e'
+ * HAL_GetTick controllato dalla prova e i comandi inviati alle camere vengono
+ * registrati.
+ *
+ * Warm-up speculativo (Bluetooth_Speculate, Door_HandleSpeculation): prefisso
+ * di "Access" (P), comando diverso (C), scadenza di SPEC_TIMEOUT_MS (C),
+ * trigger con la camera gia' calda (hit), comando diverso completato (miss),
+ * sensore di presenza e, con DOOR_COUNT > 1, il prefisso "N:" della porta.
+ *
+ * Risposta della camera (Door_SendTrigger, Door_HandleCamera,
+ * Door_HandleDeadline): hedging a FACE_HEDGE_DEFAULT_MS e poi al p95 dei
+ * campioni con un ID nuovo, verdetto accettato sia per l'ID originale sia per
+ * quello del duplicato, risposta perdente contata come tardiva, ID da '9' a
+ * '0', deadline che riporta in attesa del comando e MAX_FACE_TIMEOUTS
+ * scadenze che passano al PIN.
+ *
+ * Comandi diagnostici ("Log", "Boot", "Mem") serviti anche con la porta in
+ * lockout. Esce con 1 al primo controllo fallito. */
+#include "door.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* ------------------------------------------------------- HAL sostitutiva */
+
+static uint32_t fake_tick = 1;
+static UART_HandleTypeDef console = { 0 };
+static UART_HandleTypeDef cams[DOOR_COUNT];
+static TIM_HandleTypeDef htim;
+static GPIO_TypeDef leds;
+
+static uint8_t *rx_ptr[DOOR_COUNT + 1];     // buffer di HAL_UART_Receive_IT, 0 = console
+static char cam_log[DOOR_COUNT][256];       // comandi ricevuti da ogni camera, separati da spazi
+static char console_log[4096];
+
+static int uart_index(UART_HandleTypeDef *huart) {
+    return huart == &console ? 0 : (int)(huart - cams) + 1;
+}
+
+uint32_t HAL_GetTick(void) { return fake_tick; }
+void HAL_Delay(uint32_t ms) { fake_tick += ms; }
+
+/* Le righe vuote (preambolo di risveglio) non sono comandi */
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t size, uint32_t timeout) {
+    char *log = cam_log[uart_index(huart) - 1];
+    for (uint16_t i = 0; i < size; i++) {
+        size_t n = strlen(log);
+        if (data[i] == '\n') {
+            if (n && log[n - 1] != ' ') strcat(log, " ");
+        } else if (n + 2 < sizeof(cam_log[0])) {
+            log[n] = (char)data[i];
+            log[n + 1] = 0;
+        }
+    }
+    return HAL_OK;
+}
+
+/* Console: la trasmissione finisce subito, come se l'ISR arrivasse durante la
+   chiamata (Console_Write aspetta l'ISR quando la coda e' piena) */
+HAL_StatusTypeDef HAL_UART_Transmit_IT(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t size) {
+    size_t n = strlen(console_log);
+    if (n + size < sizeof(console_log)) {
+        memcpy(console_log + n, data, size);
+        console_log[n + size] = 0;
+    }
+    Console_TxCplt(huart);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Receive_IT(UART_HandleTypeDef *huart, uint8_t *data, uint16_t size) {
+    rx_ptr[uart_index(huart)] = data;
+    return HAL_OK;
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state) {
+    if (state == GPIO_PIN_SET) port->ODR |= pin;
+    else port->ODR &= ~(uint32_t)pin;
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_Start(TIM_HandleTypeDef *htim, uint32_t channel) { return HAL_OK; }
+
+static int boot_reports, mem_reports;
+
+void Boot_Report(void) { boot_reports++; }
+void StackGuard_Report(void) { mem_reports++; }
+
+/* ------------------------------------------------------------- Supporto */
+
+static const DoorConfig config[DOOR_COUNT] = {
+    { &htim, TIM_CHANNEL_1, &cams[0], &leds, GPIO_PIN_5, GPIO_PIN_6, GPIO_PIN_7, GPIO_PIN_0 },
+#if DOOR_COUNT >= 2
+    { &htim, TIM_CHANNEL_2, &cams[1], NULL, 0, 0, 0, 0 },
+#endif
+#if DOOR_COUNT >= 3
+    { &htim, TIM_CHANNEL_3, &cams[2], NULL, 0, 0, 0, 0 },
+#endif
+#if DOOR_COUNT >= 4
+    { &htim, TIM_CHANNEL_4, &cams[3], NULL, 0, 0, 0, 0 },
+#endif
+};
+
+static const char *current_test = "";
+static int checks = 0;
+
+#define CHECK(cond, ...) do {                                          \
+        checks++;                                                       \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "ERRORE [%s] %s:%d: ", current_test, __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__);                               \
+            fprintf(stderr, "\n");                                      \
+            exit(1);                                                    \
+        }                                                               \
+    } while (0)
+
+/* Un passo dello scheduler */
+static void poll(void) {
+    Door_Poll();
+}
+
+/* Avanza il tempo di ms servendo le porte ogni millisecondo */
+static void run(uint32_t ms) {
+    for (uint32_t i = 0; i < ms; i++) {
+        fake_tick++;
+        poll();
+    }
+    poll();
+}
+
+/* Un carattere dal modulo Bluetooth (ISR di USART2), poi un giro dello scheduler */
+static void bt_char(char c) {
+    *rx_ptr[0] = (uint8_t)c;
+    Door_UartRxCplt(&console);
+    poll();
+}
+
+static void bt_type(const char *s) {
+    while (*s) bt_char(*s++);
+}
+
+/* Risposta della camera della porta door ("Y0", "N3", ...) */
+static void cam_reply(int door, const char *s) {
+    for (; *s; s++) {
+        *rx_ptr[door + 1] = (uint8_t)*s;
+        Door_UartRxCplt(&cams[door]);
+    }
+    run(1);
+}
+
+/* Verdetto della camera per la richiesta id */
+static void cam_verdict(int door, char verdict, char id) {
+    char reply[] = { verdict, id, 0 };
+    cam_reply(door, reply);
+}
+
+/* "Access" sulla porta 1: ritorna l'ID del trigger inviato */
+static char access(void) {
+    bt_type("Access\r\n");
+    CHECK(doors[0].access_state == WAIT_FACE_RESPONSE, "dopo \"Access\" stato %d", doors[0].access_state);
+    return doors[0].req_id;
+}
+
+/* Avanza fino a ms dopo il trigger della porta 1 (il preambolo di risveglio di
+   un duplicato fa avanzare il tempo durante il giro: si guarda l'orologio) */
+static void run_until(uint32_t ms) {
+    uint32_t until = doors[0].trigger_tick + ms;
+    while (fake_tick < until) {
+        fake_tick++;
+        poll();
+    }
+    poll();
+}
+
+static int count(const char *s, const char *what) {
+    int n = 0;
+    for (s = strstr(s, what); s; s = strstr(s + 1, what)) n++;
+    return n;
+}
+
+static void begin(const char *name) {
+    current_test = name;
+    if (rx_ptr[0]) {
+        // chiude la riga lasciata a meta' dal caso precedente (bt_buffer e' statico)
+        *rx_ptr[0] = '\r';
+        Door_UartRxCplt(&console);
+    }
+    fake_tick += 60000;     // camere addormentate, speculazioni e timer precedenti scaduti
+    Door_Init(config, &console);
+    Door_Start();
+    poll();
+    for (int i = 0; i < DOOR_COUNT; i++) cam_log[i][0] = 0;
+    console_log[0] = 0;
+}
+
+/* ----------------------------------------------------------------- Casi */
+
+/* Primo carattere di "Access": "P" subito, una sola volta */
+static void test_prefix(void) {
+    begin("prefisso");
+    bt_char('a');
+    CHECK(strcmp(cam_log[0], "P ") == 0, "dopo 'a' la camera ha ricevuto \"%s\"", cam_log[0]);
+    CHECK(doors[0].spec_active, "speculazione non attiva");
+    bt_type("CCe");
+    CHECK(strcmp(cam_log[0], "P ") == 0, "i caratteri successivi hanno inviato \"%s\"", cam_log[0]);
+    CHECK(doors[0].spec_active, "speculazione annullata su un prefisso valido");
+}
+
+/* "Access" completo: il trigger consuma la speculazione senza "C" */
+static void test_hit(void) {
+    begin("hit");
+    bt_type("Access\r\n");
+    CHECK(strcmp(cam_log[0], "P 2:0 ") == 0, "la camera ha ricevuto \"%s\"", cam_log[0]);
+    CHECK(doors[0].spec_hits == 1 && doors[0].spec_misses == 0,
+          "hit %lu miss %lu", (unsigned long)doors[0].spec_hits, (unsigned long)doors[0].spec_misses);
+    CHECK(!doors[0].spec_active, "speculazione ancora attiva dopo il trigger");
+    CHECK(doors[0].access_state == WAIT_FACE_RESPONSE, "stato %d", doors[0].access_state);
+
+    cam_reply(0, "Y0");
+    CHECK(strstr(console_log, "ACCESS GRANTED") != NULL, "console: %s", console_log);
+    run(SPEC_TIMEOUT_MS);
+    CHECK(strcmp(cam_log[0], "P 2:0 ") == 0, "dopo il verdetto la camera ha ricevuto \"%s\"", cam_log[0]);
+}
+
+/* Il comando smette di essere un prefisso di "Access": "C" subito */
+static void test_diverge(void) {
+    begin("divergenza");
+    bt_type("Acx");
+    CHECK(strcmp(cam_log[0], "P C ") == 0, "la camera ha ricevuto \"%s\"", cam_log[0]);
+    CHECK(!doors[0].spec_active && doors[0].spec_misses == 1, "miss %lu", (unsigned long)doors[0].spec_misses);
+    bt_type("yz");
+    CHECK(strcmp(cam_log[0], "P C ") == 0, "altri caratteri hanno inviato \"%s\"", cam_log[0]);
+}
+
+/* Comando diverso completato: un solo "C", poi il messaggio d'aiuto */
+static void test_miss(void) {
+    begin("miss");
+    bt_type("Ax\r\n");
+    CHECK(strcmp(cam_log[0], "P C ") == 0, "la camera ha ricevuto \"%s\"", cam_log[0]);
+    CHECK(doors[0].spec_misses == 1 && doors[0].spec_hits == 0,
+          "hit %lu miss %lu", (unsigned long)doors[0].spec_hits, (unsigned long)doors[0].spec_misses);
+    CHECK(strstr(console_log, "WRITE 'ACCESS'") != NULL, "console: %s", console_log);
+
+    // comandi che non iniziano con 'A' non scaldano la camera
+    bt_type("Log\r\n");
+    CHECK(strcmp(cam_log[0], "P C ") == 0, "\"Log\" ha inviato \"%s\"", cam_log[0]);
+}
+
+/* Nessun comando entro SPEC_TIMEOUT_MS: "C" alla scadenza, il trigger dopo non e' un hit */
+static void test_timeout(void) {
+    begin("scadenza");
+    bt_type("Acc");
+    // il preambolo di risveglio (HAL_Delay) ha gia' fatto avanzare il tempo
+    run(doors[0].spec_tick + SPEC_TIMEOUT_MS - 1 - fake_tick);
+    CHECK(strcmp(cam_log[0], "P ") == 0, "prima della scadenza la camera ha ricevuto \"%s\"", cam_log[0]);
+    CHECK(doors[0].spec_active, "speculazione annullata prima della scadenza");
+    run(1);
+    CHECK(strcmp(cam_log[0], "P C ") == 0, "alla scadenza la camera ha ricevuto \"%s\"", cam_log[0]);
+    CHECK(doors[0].spec_misses == 1, "miss %lu", (unsigned long)doors[0].spec_misses);
+
+    bt_type("ess\r\n");
+    CHECK(strcmp(cam_log[0], "P C 2:0 ") == 0, "la camera ha ricevuto \"%s\"", cam_log[0]);
+    CHECK(doors[0].spec_hits == 0, "hit %lu dopo la scadenza", (unsigned long)doors[0].spec_hits);
+}
+
+/* Sensore di presenza: "P" senza caratteri, il comando successivo e' un hit */
+static void test_presence(void) {
+    begin("presenza");
+    Door_PresenceDetected(GPIO_PIN_0);
+    poll();
+    CHECK(strcmp(cam_log[0], "P ") == 0, "la camera ha ricevuto \"%s\"", cam_log[0]);
+    bt_type("access\r\n");
+    CHECK(strcmp(cam_log[0], "P 2:0 ") == 0, "la camera ha ricevuto \"%s\"", cam_log[0]);
+    CHECK(doors[0].spec_hits == 1, "hit %lu", (unsigned long)doors[0].spec_hits);
+
+    // durante il riconoscimento ne' il sensore ne' i caratteri scaldano la camera
+    Door_PresenceDetected(GPIO_PIN_0);
+    bt_char('A');
+    run(SPEC_TIMEOUT_MS);
+    CHECK(strncmp(cam_log[0], "P 2:0 ", 6) == 0 && strchr(cam_log[0] + 6, 'P') == NULL &&
+          strchr(cam_log[0] + 6, 'C') == NULL, "la camera ha ricevuto \"%s\"", cam_log[0]);
+}
+
+#if DOOR_COUNT > 1
+/* "N:" indirizza la porta N; una cifra iniziale da sola non scalda nessuna camera */
+static void test_door_prefix(void) {
+    begin("prefisso porta");
+    bt_char('2');
+    CHECK(cam_log[0][0] == 0 && cam_log[1][0] == 0, "dopo '2' le camere hanno ricevuto \"%s\" / \"%s\"",
+          cam_log[0], cam_log[1]);
+    bt_type(":A");
+    CHECK(cam_log[0][0] == 0 && strcmp(cam_log[1], "P ") == 0,
+          "dopo \"2:A\" le camere hanno ricevuto \"%s\" / \"%s\"", cam_log[0], cam_log[1]);
+    bt_type("ccess\r\n");
+    CHECK(strcmp(cam_log[1], "P 2:0 ") == 0 && doors[1].spec_hits == 1,
+          "la camera 2 ha ricevuto \"%s\"", cam_log[1]);
+    CHECK(doors[0].spec_hits == 0 && doors[0].spec_misses == 0 && cam_log[0][0] == 0,
+          "la porta 1 e' stata coinvolta: \"%s\"", cam_log[0]);
+
+    bt_type("2:Ax");
+    CHECK(strcmp(cam_log[1], "P 2:0 ") == 0, "porta 2 in riconoscimento: \"%s\"", cam_log[1]);
+    CHECK(cam_log[0][0] == 0, "la porta 1 ha ricevuto \"%s\"", cam_log[0]);
+}
+#endif
+
+/* Nessun campione: duplicato a FACE_HEDGE_DEFAULT_MS con un ID nuovo; vince
+   il duplicato e la risposta all'ID originale, arrivata dopo, e' tardiva */
+static void test_hedge_default(void) {
+    begin("hedging predefinito");
+    char id = access();
+    CHECK(id == '0' && strcmp(cam_log[0], "P 2:0 ") == 0, "id %c, la camera ha ricevuto \"%s\"", id, cam_log[0]);
+    run_until(FACE_HEDGE_DEFAULT_MS - 1);
+    CHECK(doors[0].hedge_id == 0 && strcmp(cam_log[0], "P 2:0 ") == 0,
+          "duplicato prima della soglia: \"%s\"", cam_log[0]);
+    run(1);
+    CHECK(doors[0].hedge_id == '1' && strcmp(cam_log[0], "P 2:0 2:1 ") == 0,
+          "alla soglia la camera ha ricevuto \"%s\"", cam_log[0]);
+
+    cam_verdict(0, 'Y', '1');
+    CHECK(count(console_log, "ACCESS GRANTED") == 1 && doors[0].access_state == WAIT_ACCESS_COMMAND,
+          "verdetto del duplicato non accettato: %s", console_log);
+    cam_verdict(0, 'Y', '0');
+    CHECK(doors[0].stale_replies == 1, "tardive %lu", (unsigned long)doors[0].stale_replies);
+    CHECK(count(console_log, "ACCESS GRANTED") == 1, "risposta perdente accettata: %s", console_log);
+}
+
+/* Dopo il duplicato vale anche la risposta all'ID originale; perde quella del duplicato */
+static void test_hedge_original(void) {
+    begin("hedging, vince l'originale");
+    char id = access();
+    run_until(FACE_HEDGE_DEFAULT_MS);
+    CHECK(doors[0].hedge_id == id + 1, "duplicato %c dopo %c", doors[0].hedge_id, id);
+
+    cam_verdict(0, 'N', id);
+    CHECK(strstr(console_log, "FACE NOT RECOGNIZED") != NULL && doors[0].face_attempts == 1,
+          "verdetto dell'originale non accettato: %s", console_log);
+    CHECK(doors[0].access_state == WAIT_ACCESS_COMMAND, "stato %d", doors[0].access_state);
+    cam_verdict(0, 'N', id + 1);
+    CHECK(doors[0].stale_replies == 1 && doors[0].face_attempts == 1,
+          "tardive %lu, tentativi %d", (unsigned long)doors[0].stale_replies, doors[0].face_attempts);
+}
+
+/* Con FACE_LATENCY_MIN_SAMPLES campioni la soglia diventa il loro p95 */
+static void test_hedge_p95(void) {
+    static const uint32_t latency[FACE_LATENCY_MIN_SAMPLES] = { 1200, 1500, 2200, 1800 };
+
+    begin("hedging al p95");
+    for (int i = 0; i < FACE_LATENCY_MIN_SAMPLES; i++) {
+        char id = access();
+        run_until(latency[i] - 1);
+        cam_verdict(0, 'Y', id);        // gestito al millisecondo successivo
+        CHECK(doors[0].face_latency_count == i + 1 && doors[0].face_latency[i] == latency[i],
+              "campione %d: %u ms", i, doors[0].face_latency[i]);
+        CHECK(doors[0].hedge_id == 0, "duplicato a %lu ms", (unsigned long)latency[i]);
+    }
+
+    cam_log[0][0] = 0;
+    char id = access();
+    run_until(2200 - 1);
+    CHECK(doors[0].hedge_id == 0, "duplicato prima del p95: \"%s\"", cam_log[0]);
+    run(1);
+    CHECK(doors[0].hedge_id == id + 1 && strcmp(cam_log[0], "P 2:4 2:5 ") == 0,
+          "al p95 la camera ha ricevuto \"%s\"", cam_log[0]);
+}
+
+/* Gli ID ripartono da '0' dopo '9', anche per il duplicato */
+static void test_id_wrap(void) {
+    begin("giro degli ID");
+    for (char expect = '0'; expect <= '8'; expect++) {
+        char id = access();
+        CHECK(id == expect, "ID %c invece di %c", id, expect);
+        cam_verdict(0, 'Y', id);
+    }
+
+    cam_log[0][0] = 0;
+    char id = access();
+    CHECK(id == '9', "ID %c invece di 9", id);
+    // campioni di 1 ms: la soglia resta al minimo
+    run_until(FACE_HEDGE_MIN_MS);
+    CHECK(doors[0].hedge_id == '0' && strcmp(cam_log[0], "P 2:9 2:0 ") == 0,
+          "duplicato %c, la camera ha ricevuto \"%s\"", doors[0].hedge_id ? doors[0].hedge_id : '-', cam_log[0]);
+    cam_verdict(0, 'Y', '0');
+    CHECK(doors[0].access_state == WAIT_ACCESS_COMMAND, "verdetto del duplicato '0' non accettato");
+    cam_verdict(0, 'Y', '9');
+    CHECK(doors[0].stale_replies == 1, "tardive %lu", (unsigned long)doors[0].stale_replies);
+
+    // il trigger successivo riparte dall'ID del duplicato
+    for (char expect = '1'; expect <= '9'; expect++) {
+        id = access();
+        CHECK(id == expect, "ID %c invece di %c", id, expect);
+        cam_verdict(0, 'Y', id);
+    }
+    id = access();
+    CHECK(id == '0', "dopo '9' il trigger ha ID %c", id);
+}
+
+/* Deadline senza risposta: di nuovo in attesa di "Access", con ID nuovi; alla
+   MAX_FACE_TIMEOUTS-esima scadenza si passa al PIN. Le risposte dopo la
+   scadenza sono tardive. */
+static void test_deadline(void) {
+    begin("deadline");
+    for (int t = 1; t <= MAX_FACE_TIMEOUTS; t++) {
+        console_log[0] = 0;
+        char id = access();
+        CHECK(id == '0' + 2 * (t - 1), "scadenza %d: ID %c", t, id);
+        run_until(FACE_RESPONSE_DEADLINE_MS - 1);
+        CHECK(doors[0].access_state == WAIT_FACE_RESPONSE && doors[0].hedge_id == id + 1,
+              "scadenza %d: stato %d, duplicato %c prima della deadline", t, doors[0].access_state,
+              doors[0].hedge_id ? doors[0].hedge_id : '-');
+        run(1);
+        CHECK(doors[0].hedge_id == 0 && doors[0].cam_verdict == 0, "scadenza %d: richiesta non chiusa", t);
+        if (t < MAX_FACE_TIMEOUTS) {
+            CHECK(doors[0].access_state == WAIT_ACCESS_COMMAND && doors[0].face_timeouts == t,
+                  "scadenza %d: stato %d, scadenze %d", t, doors[0].access_state, doors[0].face_timeouts);
+            CHECK(strstr(console_log, "CAMERA NOT RESPONDING. TRY AGAIN") != NULL, "console: %s", console_log);
+        } else {
+            CHECK(doors[0].access_state == WAIT_PIN && doors[0].face_timeouts == 0,
+                  "scadenza %d: stato %d, scadenze %d", t, doors[0].access_state, doors[0].face_timeouts);
+            CHECK(strstr(console_log, "CAMERA NOT RESPONDING. INSERT PIN") != NULL, "console: %s", console_log);
+        }
+
+        AccessState state = doors[0].access_state;
+        cam_verdict(0, 'Y', id + 1);
+        CHECK(doors[0].stale_replies == (uint32_t)t && doors[0].access_state == state &&
+              strstr(console_log, "ACCESS GRANTED") == NULL,
+              "scadenza %d: risposta tardiva accettata (tardive %lu)", t, (unsigned long)doors[0].stale_replies);
+    }
+
+    bt_type("1234\r\n");
+    CHECK(strstr(console_log, "ACCESS GRANTED") != NULL, "PIN dopo le scadenze: %s", console_log);
+}
+
+/* Porta 1 in lockout: "Access" e' ignorato, i comandi diagnostici no */
+static void test_lockout_global(void) {
+    begin("comandi in lockout");
+    for (int i = 0; i < MAX_FACE_ATTEMPTS; i++)
+        cam_verdict(0, 'N', access());
+    CHECK(doors[0].access_state == WAIT_PIN, "stato %d dopo %d rifiuti", doors[0].access_state, MAX_FACE_ATTEMPTS);
+    bt_type("0000\r\n");
+    CHECK(doors[0].access_state == LOCKOUT, "stato %d dopo un PIN errato", doors[0].access_state);
+
+    cam_log[0][0] = 0;
+    console_log[0] = 0;
+    bt_type("Access\r\n");
+    CHECK(cam_log[0][0] == 0 && doors[0].access_state == LOCKOUT,
+          "\"Access\" in lockout: la camera ha ricevuto \"%s\"", cam_log[0]);
+
+    int boot = boot_reports, mem = mem_reports;
+    bt_type("Log\r\n");
+    CHECK(strstr(console_log, "PIN_DENIED") != NULL && strstr(console_log, "D1 WARM-UP HIT") != NULL,
+          "\"Log\" in lockout: %s", console_log);
+    bt_type("boot\r\n");
+    bt_type("MEM\r\n");
+    CHECK(boot_reports == boot + 1 && mem_reports == mem + 1,
+          "in lockout Boot %d, Mem %d", boot_reports - boot, mem_reports - mem);
+    CHECK(doors[0].access_state == LOCKOUT, "i comandi diagnostici hanno cambiato lo stato: %d",
+          doors[0].access_state);
+
+    run(LOCKOUT_TIME);
+    CHECK(doors[0].access_state == WAIT_ACCESS_COMMAND, "stato %d dopo il lockout", doors[0].access_state);
+}
+
+int main(void) {
+    test_prefix();
+    test_hit();
+    test_diverge();
+    test_miss();
+    test_timeout();
+    test_presence();
+#if DOOR_COUNT > 1
+    test_door_prefix();
+#endif
+    test_hedge_default();
+    test_hedge_original();
+    test_hedge_p95();
+    test_id_wrap();
+    test_deadline();
+    test_lockout_global();
+    printf("[TEST] door.c, %d porte: %d controlli ok\n", DOOR_COUNT, checks);
+    return 0;
+}
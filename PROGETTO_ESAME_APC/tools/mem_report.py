@@ -0,0 +1,264 @@
+#!/usr/bin/env python3
+"""
+Report di memoria del firmware STM32 (eseguito come post-build in STM32CubeIDE).
+
+1. Stack: legge i file .ci prodotti da -fcallgraph-info=su, calcola il caso
+   peggiore lungo il grafo delle chiamate partendo da main() e da ogni handler
+   di interrupt, e fallisce se supera il budget (_Min_Stack_Size del linker
+   script, oppure --budget) o se il frame di una funzione è più grande della
+   guardia MPU sotto lo stack (_Stack_Guard_Size): quella funzione potrebbe
+   scavalcarla e scrivere sotto lo stack senza fault.
+2. RAM/flash: dal file .map del linker ricava l'occupazione per modulo.
+
+Uso (dalla cartella di build, es. Debug/):
+    python3 ../tools/mem_report.py --build-dir . --ld ../STM32F303VCTX_FLASH.ld
+"""
+import argparse
+import os
+import re
+import sys
+from collections import defaultdict
+
+# Frame salvato dall'hardware all'ingresso di un'eccezione: 8 word, 26 con il
+# contesto FPU (il progetto usa -mfloat-abi=hard)
+EXCEPTION_FRAME = 104
+
+# Chiamate tramite puntatore a funzione note nel progetto (callback della HAL):
+# il costo di __indirect_call dentro la funzione a sinistra è il massimo tra
+# quelli delle funzioni a destra
+INDIRECT_CALLS = {
+    'HAL_UART_IRQHandler': ['UART_RxISR_8BIT', 'UART_RxISR_16BIT', 'UART_TxISR_8BIT', 'UART_TxISR_16BIT'],
+    'HAL_I2C_EV_IRQHandler': ['I2C_Master_ISR_IT', 'I2C_Slave_ISR_IT', 'I2C_Master_ISR_DMA', 'I2C_Slave_ISR_DMA'],
+}
+
+NODE_RE = re.compile(r'node: \{ title: "([^"]+)" label: "([^"]*)"')
+EDGE_RE = re.compile(r'edge: \{ sourcename: "([^"]+)" targetname: "([^"]+)"')
+STACK_RE = re.compile(r'\\n(\d+) bytes \(([a-z,]+)\)')
+
+
+def parse_callgraph(build_dir):
+    frames = {}               # funzione -> (byte, qualificatore)
+    calls = defaultdict(set)  # funzione -> funzioni chiamate
+    for root, _, files in os.walk(build_dir):
+        for name in files:
+            if not name.endswith('.ci'):
+                continue
+            with open(os.path.join(root, name), encoding='utf-8', errors='replace') as f:
+                for line in f:
+                    m = NODE_RE.search(line)
+                    if m:
+                        s = STACK_RE.search(m.group(2))
+                        if s:
+                            frames[m.group(1)] = (int(s.group(1)), s.group(2))
+                        continue
+                    m = EDGE_RE.search(line)
+                    if m:
+                        calls[m.group(1)].add(m.group(2))
+    return frames, calls
+
+
+def resolve(name, caller, frames):
+    """Le funzioni static compaiono come 'file.c:nome': preferisce quella del file del chiamante."""
+    if name in frames:
+        return name
+    if ':' in caller:
+        local = caller.split(':')[0] + ':' + name
+        if local in frames:
+            return local
+    for title in frames:
+        if title.endswith(':' + name):
+            return title
+    return name
+
+
+class StackAnalysis:
+    def __init__(self, frames, calls, unknown_cost):
+        self.frames = frames
+        self.calls = calls
+        self.unknown_cost = unknown_cost
+        self.memo = {}
+        self.unknown = set()
+        self.dynamic = set()
+        self.recursive = set()
+
+    def worst(self, fn, stack=()):
+        """Ritorna (byte, catena di chiamate) del percorso peggiore da fn."""
+        if fn in self.memo:
+            return self.memo[fn]
+        if fn in stack:
+            self.recursive.add(fn)
+            return 0, [fn + ' (ricorsione)']
+        if fn not in self.frames:
+            self.unknown.add(fn)
+            return self.unknown_cost, [fn + ' (?)']
+
+        own, qual = self.frames[fn]
+        if 'dynamic' in qual and 'bounded' not in qual:
+            self.dynamic.add(fn)
+
+        best, chain = 0, []
+        for callee in self.calls.get(fn, ()):
+            if callee == '__indirect_call':
+                targets = INDIRECT_CALLS.get(fn.split(':')[-1])
+                if targets is None:
+                    self.unknown.add('__indirect_call in ' + fn)
+                    cost, sub = self.unknown_cost, ['__indirect_call (?)']
+                else:
+                    cost, sub = max((self.worst(resolve(t, fn, self.frames), stack + (fn,)) for t in targets),
+                                    key=lambda r: r[0])
+            else:
+                cost, sub = self.worst(resolve(callee, fn, self.frames), stack + (fn,))
+            if cost > best:
+                best, chain = cost, sub
+
+        self.memo[fn] = (own + best, [fn] + chain)
+        return self.memo[fn]
+
+
+def read_ld_symbol(ld_path, symbol):
+    with open(ld_path, encoding='utf-8') as f:
+        m = re.search(r'\b' + symbol + r'\s*=\s*(0x[0-9a-fA-F]+|\d+)\s*;', f.read())
+    return int(m.group(1), 0) if m else None
+
+
+def stack_report(args):
+    frames, calls = parse_callgraph(args.build_dir)
+    if not frames:
+        print('[STACK] nessun file .ci trovato: compilare con -fstack-usage -fcallgraph-info=su')
+        return False
+
+    budget = args.budget if args.budget is not None else read_ld_symbol(args.ld, '_Min_Stack_Size')
+    analysis = StackAnalysis(frames, calls, args.unknown_cost)
+
+    main_cost, main_chain = analysis.worst('main')
+    handlers = sorted(f for f in frames if f.endswith('_Handler') or f.endswith('_IRQHandler'))
+    irq = sorted(((analysis.worst(h)[0] + EXCEPTION_FRAME, h) for h in handlers), reverse=True)
+    irq_cost = sum(cost for cost, _ in irq[:args.irq_nesting])
+    total = main_cost + irq_cost
+
+    print('[STACK] main: %d byte' % main_cost)
+    print('        ' + ' -> '.join(main_chain))
+    for cost, h in irq[:5]:
+        print('[STACK] %-28s %5d byte (frame eccezione incluso)' % (h, cost))
+    print('[STACK] caso peggiore: main + %d livelli di interrupt = %d byte, budget %s byte'
+          % (args.irq_nesting, total, budget))
+
+    for fn in sorted(analysis.unknown):
+        print('[STACK] attenzione: %s senza informazioni di stack, stimato %d byte' % (fn, args.unknown_cost))
+    for fn in sorted(analysis.dynamic):
+        print('[STACK] errore: %s usa stack dinamico non limitato' % fn)
+    for fn in sorted(analysis.recursive):
+        print('[STACK] errore: %s è ricorsiva' % fn)
+
+    ok = not analysis.dynamic and not analysis.recursive
+    if budget is not None and total > budget:
+        print('[STACK] errore: budget superato di %d byte' % (total - budget))
+        ok = False
+    return guard_check(args, frames, analysis) and ok
+
+
+def guard_check(args, frames, analysis):
+    """Ogni frame deve stare nella guardia: SP non può superarla con un solo passo"""
+    guard = read_ld_symbol(args.ld, '_Stack_Guard_Size')
+    if guard is None:
+        return True
+    size, fn = max((size, fn) for fn, (size, _) in frames.items())
+    print('[STACK] frame più grande: %s %d byte, guardia %d byte' % (fn, size, guard))
+
+    ok = True
+    for fn, (size, _) in sorted(frames.items(), key=lambda item: -item[1][0]):
+        if size <= guard:
+            break
+        print('[STACK] errore: il frame di %s (%d byte) supera la guardia dello stack (%d byte)' % (fn, size, guard))
+        ok = False
+    if analysis.unknown and args.unknown_cost > guard:
+        print('[STACK] attenzione: le funzioni senza informazioni di stack sono stimate %d byte, '
+              'più della guardia (%d byte)' % (args.unknown_cost, guard))
+    return ok
+
+
+SECTION_RE = re.compile(r'^ (\S+)\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S.*)$')
+CONT_RE = re.compile(r'^\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S.*)$')
+
+
+def module_name(obj):
+    m = re.match(r'.*/(lib[^/]*\.a)\((?:lib_a-)?([^)]*)\.o\)$', obj)
+    if m:
+        return '%s(%s)' % (m.group(1), m.group(2))
+    return os.path.basename(obj)
+
+
+def map_report(args):
+    maps = [os.path.join(args.build_dir, f) for f in os.listdir(args.build_dir) if f.endswith('.map')]
+    if args.map:
+        maps = [args.map]
+    if not maps:
+        print('[MAP] nessun file .map trovato')
+        return
+
+    flash = defaultdict(int)
+    ram = defaultdict(int)
+    in_map = False
+    pending = None
+    with open(maps[0], encoding='utf-8', errors='replace') as f:
+        for line in f:
+            if line.startswith('Linker script and memory map'):
+                in_map = True
+                continue
+            if not in_map:
+                continue
+            m = SECTION_RE.match(line)
+            if m:
+                section, addr, size, obj = m.group(1), int(m.group(2), 16), int(m.group(3), 16), m.group(4)
+            else:
+                c = CONT_RE.match(line) if pending else None
+                if c is None:
+                    # nome della sezione da solo: indirizzo e dimensione sulla riga successiva
+                    s = line.strip()
+                    pending = s if line.startswith(' .') and ' ' not in s else None
+                    continue
+                section, addr, size, obj = pending, int(c.group(1), 16), int(c.group(2), 16), c.group(3)
+            pending = None
+            if size == 0 or section.startswith('*') or not obj.endswith(('.o', '.o)')):
+                continue
+
+            mod = module_name(obj)
+            if 0x08000000 <= addr < 0x08100000:
+                flash[mod] += size
+            elif 0x20000000 <= addr < 0x20100000 or 0x10000000 <= addr < 0x10010000:
+                ram[mod] += size
+                if section.startswith(('.data', '.ccmram', '.RamFunc')):
+                    flash[mod] += size  # immagine di inizializzazione in flash
+
+    print('[MAP] %-40s %8s %8s' % ('modulo', 'flash', 'ram'))
+    for mod in sorted(set(flash) | set(ram), key=lambda k: -(flash[k] + ram[k])):
+        print('[MAP] %-40s %8d %8d' % (mod, flash[mod], ram[mod]))
+    print('[MAP] %-40s %8d %8d' % ('totale', sum(flash.values()), sum(ram.values())))
+
+    heap = read_ld_symbol(args.ld, '_Min_Heap_Size') or 0
+    stack = read_ld_symbol(args.ld, '_Min_Stack_Size') or 0
+    guard = read_ld_symbol(args.ld, '_Stack_Guard_Size') or 0
+    used = sum(ram.values()) + heap + stack + guard
+    print('[MAP] RAM riservata (statica + heap + stack + guardia): %d / %d byte' % (used, args.ram_size))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--build-dir', default='.', help='cartella con .o/.su/.ci/.map')
+    parser.add_argument('--ld', default=os.path.join(os.path.dirname(__file__), '..', 'STM32F303VCTX_FLASH.ld'))
+    parser.add_argument('--map', help='file .map (default: il primo nella cartella di build)')
+    parser.add_argument('--budget', type=lambda v: int(v, 0), help='budget stack in byte (default: _Min_Stack_Size)')
+    parser.add_argument('--irq-nesting', type=int, default=2,
+                        help='livelli di preemption degli interrupt da sommare (default 2: UART a priorità 0, I2C a 1)')
+    parser.add_argument('--unknown-cost', type=int, default=256,
+                        help='byte stimati per funzioni di libreria senza .ci (es. snprintf di newlib)')
+    parser.add_argument('--ram-size', type=int, default=40 * 1024)
+    args = parser.parse_args()
+
+    ok = stack_report(args)
+    map_report(args)
+    sys.exit(0 if ok else 1)
+
+
+if __name__ == '__main__':
+    main()
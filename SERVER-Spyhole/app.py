@@ -2,12 +2,21 @@ from flask import Flask, request, jsonify, send_from_directory, render_template,
 from flask_sqlalchemy import SQLAlchemy
 from werkzeug.security import generate_password_hash, check_password_hash
 from werkzeug.utils import secure_filename
+from werkzeug.serving import WSGIRequestHandler
 import face_recognition
 import os
 import io
+import time
+import socket
+import socketserver
+import struct
+import threading
+from collections import deque
 from datetime import datetime
 from PIL import Image
 from functools import wraps
+from face_index import open_index
+from telemetry import from_headers, log_telemetry
 
 app = Flask(__name__)
 app.secret_key = 'your-secret-key-change-this-in-production'  # Cambia questo in produzione!
@@ -88,49 +97,252 @@ def login_required(f):
 # RICONOSCIMENTO FACCIALE
 # ============================================
 
-# Carica volti noti all'avvio
-known_face_encodings = []
-known_face_names = []
+# Soglia sulla distanza tra encoding (più severa del default 0.6 per sicurezza)
+MATCH_THRESHOLD = 0.4
+
+# Indice dei volti noti (face_index.py): 'exact' confronta con tutti, 'ivf' è
+# approssimato per popolazioni grandi (100.000+ volti). Resta su disco tra un
+# avvio e l'altro: all'avvio si codificano solo le foto nuove o cambiate.
+FACE_INDEX_KIND = 'exact'
+FACE_INDEX_PATH = os.path.join(basedir, 'instance', 'face_index.npz')
+
+known_faces = open_index(FACE_INDEX_KIND, FACE_INDEX_PATH)
 
 def load_known_faces():
     """
-    Ogni immagine viene codificata e il nome viene estratto dal filename.
+    Allinea l'indice alle foto in KNOWN_FOLDER: ogni immagine nuova o più
+    recente dell'indice salvato viene codificata (il nome viene estratto dal
+    filename), i volti senza più una foto vengono tolti.
     """
+    saved_at = os.path.getmtime(FACE_INDEX_PATH) if os.path.exists(FACE_INDEX_PATH) else 0
+    pictures = {}
     for filename in os.listdir(KNOWN_FOLDER):
         if filename.lower().endswith(('.jpg', '.jpeg', '.png')):
-            path = os.path.join(KNOWN_FOLDER, filename)
-            image = face_recognition.load_image_file(path)
-            encodings = face_recognition.face_encodings(image)
-            if encodings:
-                known_face_encodings.append(encodings[0])
-                known_face_names.append(os.path.splitext(filename)[0])
-    print(f"[INFO] {len(known_face_encodings)} known faces loaded.")
+            pictures[os.path.splitext(filename)[0]] = os.path.join(KNOWN_FOLDER, filename)
+
+    changed = 0
+    for name in [name for name in known_faces.ids if name not in pictures]:
+        known_faces.remove(name)
+        changed += 1
+    for name, path in pictures.items():
+        if name in known_faces and os.path.getmtime(path) < saved_at:
+            continue
+        image = face_recognition.load_image_file(path)
+        encodings = face_recognition.face_encodings(image)
+        if encodings:
+            known_faces.add(name, encodings[0])
+            changed += 1
+        elif known_faces.remove(name):
+            changed += 1
+    if changed:
+        known_faces.save(FACE_INDEX_PATH)
+    print(f"[INFO] {len(known_faces)} known faces loaded ({FACE_INDEX_KIND}, {changed} aggiornati).")
 
 load_known_faces()
 
-def recognize_face(image_bytes):
+def recognize_face(image_bytes, face_crop=False):
     """
     Riconosce un volto comparandolo con quelli noti.
+    Con face_crop=True l'immagine è già il ritaglio del volto fatto dall'ESP32-CAM:
+    si salta la detection HOG e si codifica l'intera immagine.
+    Ritorna (riconosciuto, nome o motivo, distanza migliore o None se nessun volto).
     """
     # Carica immagine ricevuta
     unknown_image = face_recognition.load_image_file(io.BytesIO(image_bytes))
-    unknown_encodings = face_recognition.face_encodings(unknown_image)
+    if face_crop:
+        height, width = unknown_image.shape[:2]
+        unknown_encodings = face_recognition.face_encodings(unknown_image, known_face_locations=[(0, width, height, 0)])
+    else:
+        unknown_encodings = face_recognition.face_encodings(unknown_image)
 
     if not unknown_encodings:
-        return False, "No face found"
+        return False, "No face found", None
 
-    unknown_encoding = unknown_encodings[0]
+    name, best_distance = known_faces.search(unknown_encodings[0])
+    if name is None:
+        return False, "Unknown", None
 
-    # Calcola la distanza tra volti (soglia: 0.4 per maggiore precisione)
-    face_distances = face_recognition.face_distance(known_face_encodings, unknown_encoding)
-    best_match_index = face_distances.argmin()
-    best_distance = face_distances[best_match_index]
-
-    # Soglia più severa per sicurezza
-    if best_distance < 0.4:
-        return True, known_face_names[best_match_index]
+    if best_distance < MATCH_THRESHOLD:
+        return True, name, best_distance
     else:
-        return False, "Unknown"
+        return False, "Unknown", best_distance
+
+
+# Ultimo risultato di ogni camera, per i frame ripetuti: l'ESP32 invia solo un
+# riferimento (BIN_FLAG_REPEAT / X-Repeat) quando il frame è uguale all'ultimo
+# caricato. L'ESP32 considera valido un verdetto per 5 s; qui si tiene un margine.
+REPEAT_MAX_AGE_S = 30
+last_results = {}  # camera -> (istante, risultato, nome o motivo, distanza)
+
+
+def repeat_access(device):
+    """
+    Registra di nuovo l'ultimo accesso della camera (stessa immagine, stesso
+    esito) senza rifare il riconoscimento. Stesso formato di process_access,
+    None se non c'è un risultato recente: la camera deve inviare l'immagine.
+    """
+    entry = last_results.get(device)
+    if entry is None or time.monotonic() - entry[0] > REPEAT_MAX_AGE_S:
+        return None
+    _, result, name_or_msg, distance = entry
+    repeated = dict(result, timestamp=datetime.now().strftime("%Y%m%d_%H%M%S"), repeat=True)
+    access_log.append(repeated)
+    print(f"[DEDUP] {device} ripetuto {result['filename']} ({'ok' if result['recognized'] else 'not ok'})")
+    return repeated, name_or_msg, distance, 0
+
+
+def process_access(image_bytes, face_crop=False, device=None):
+    """
+    Salva l'immagine, esegue il riconoscimento e registra l'accesso.
+    Usata sia da /upload (HTTP) sia dal canale binario dell'ESP32-CAM.
+    Ritorna (risultato, nome o motivo, distanza, tempo di riconoscimento in ms).
+    """
+    # Salva immagine ricevuta con timestamp (e camera: più porte nello stesso secondo)
+    timestamp = datetime.now().strftime("%Y%m%d_%H%M%S")
+    filename = f"image_{timestamp}.jpg" if device is None else f"image_{timestamp}_{secure_filename(device)}.jpg"
+    image_path = os.path.join(UPLOAD_FOLDER, filename)
+    image = Image.open(io.BytesIO(image_bytes))
+    image.save(image_path)
+
+    # Riconoscimento facciale
+    recognize_start = time.perf_counter()
+    recognized, name_or_msg, distance = recognize_face(image_bytes, face_crop)
+    server_ms = int((time.perf_counter() - recognize_start) * 1000)
+    result = {
+        'timestamp': timestamp,
+        'filename': filename,
+        'recognized': recognized,
+        'name': name_or_msg if recognized else "Unknown",
+        'device': device
+    }
+    access_log.append(result)
+    if device is not None:
+        last_results[device] = (time.monotonic(), result, name_or_msg, distance)
+    return result, name_or_msg, distance, server_ms
+
+
+# ============================================
+# SCHEDULER DEI RICONOSCIMENTI
+# ============================================
+# Ogni camera ha la propria coda; RECOGNITION_WORKERS thread servono le camere a
+# turno (round robin), al massimo DEVICE_MAX_IN_FLIGHT riconoscimenti per camera.
+# Una camera che invia molti frame allunga solo la propria coda: le altre
+# aspettano al più un riconoscimento per worker. Oltre DEVICE_MAX_QUEUED frame
+# in coda, o dopo QUEUE_DEADLINE_S di attesa (lo STM32 ha già rinunciato), il
+# frame viene scartato con esito negativo.
+
+RECOGNITION_WORKERS = max(2, os.cpu_count() or 2)
+DEVICE_MAX_IN_FLIGHT = 1
+DEVICE_MAX_QUEUED = 4
+QUEUE_DEADLINE_S = 8.0   # FACE_RESPONSE_DEADLINE_MS dello STM32
+METRICS_WINDOW = 64
+
+
+class SchedulerBusy(Exception):
+    """Frame scartato dallo scheduler (coda piena o scaduto)"""
+
+
+class RecognitionScheduler:
+    def __init__(self, workers=RECOGNITION_WORKERS, max_in_flight=DEVICE_MAX_IN_FLIGHT, max_queued=DEVICE_MAX_QUEUED):
+        self.max_in_flight = max_in_flight
+        self.max_queued = max_queued
+        self.cond = threading.Condition()
+        self.queues = {}      # camera -> deque di job in attesa
+        self.running = {}     # camera -> riconoscimenti in corso
+        self.ready = deque()  # camere con job in coda e sotto il limite, in ordine di turno
+        self.metrics = {}     # camera -> contatori e finestre di latenza
+        for i in range(workers):
+            threading.Thread(target=self.worker, name=f"recognition-{i}", daemon=True).start()
+
+    def device_metrics(self, device):
+        if device not in self.metrics:
+            self.metrics[device] = {'submitted': 0, 'completed': 0, 'rejected': 0, 'expired': 0, 'failed': 0,
+                                    'wait_ms': deque(maxlen=METRICS_WINDOW), 'service_ms': deque(maxlen=METRICS_WINDOW)}
+        return self.metrics[device]
+
+    def run(self, device, fn, *args):
+        """Esegue fn(*args) nel turno della camera e ne ritorna il risultato; SchedulerBusy se scartato"""
+        job = {'fn': fn, 'args': args, 'queued_at': time.monotonic(), 'done': threading.Event()}
+        with self.cond:
+            stats = self.device_metrics(device)
+            stats['submitted'] += 1
+            queue = self.queues.setdefault(device, deque())
+            if len(queue) >= self.max_queued:
+                stats['rejected'] += 1
+                print(f"[SCHED] {device} coda piena ({len(queue)}), frame scartato")
+                raise SchedulerBusy('coda piena')
+            queue.append(job)
+            self.make_ready(device)
+            self.cond.notify()
+        job['done'].wait()
+        if 'error' in job:
+            raise job['error']
+        return job['result']
+
+    def make_ready(self, device):
+        # chiamata con il lock: la camera entra nel turno se ha lavoro e non è al limite
+        if (self.queues.get(device) and self.running.get(device, 0) < self.max_in_flight
+                and device not in self.ready):
+            self.ready.append(device)
+
+    def worker(self):
+        while True:
+            with self.cond:
+                while not self.ready:
+                    self.cond.wait()
+                device = self.ready.popleft()
+                job = self.queues[device].popleft()
+                self.running[device] = self.running.get(device, 0) + 1
+                self.make_ready(device)   # in fondo al turno, dietro alle altre camere
+                if self.ready:
+                    self.cond.notify()
+            self.execute(device, job)
+            with self.cond:
+                self.running[device] -= 1
+                self.make_ready(device)
+                if self.ready:
+                    self.cond.notify()
+
+    def execute(self, device, job):
+        start = time.monotonic()
+        wait = start - job['queued_at']
+        try:
+            if wait > QUEUE_DEADLINE_S:
+                print(f"[SCHED] {device} frame scaduto dopo {wait:.1f}s in coda")
+                job['error'] = SchedulerBusy('scaduto')
+            else:
+                job['result'] = job['fn'](*job['args'])
+        except Exception as e:
+            job['error'] = e
+        with self.cond:
+            stats = self.device_metrics(device)
+            error = job.get('error')
+            if error is None:
+                stats['completed'] += 1
+                stats['wait_ms'].append(wait * 1000)
+                stats['service_ms'].append((time.monotonic() - start) * 1000)
+            else:
+                stats['expired' if isinstance(error, SchedulerBusy) else 'failed'] += 1
+        job['done'].set()
+
+    def snapshot(self):
+        """Metriche per camera: contatori, coda, in corso, attesa e servizio (p50/p95 in ms)"""
+        def percentiles(values):
+            ordered = sorted(values)
+            if not ordered:
+                return None
+            return {'p50': round(ordered[(len(ordered) - 1) // 2], 1),
+                    'p95': round(ordered[(len(ordered) - 1) * 95 // 100], 1)}
+
+        with self.cond:
+            return {device: {'submitted': s['submitted'], 'completed': s['completed'], 'rejected': s['rejected'],
+                             'expired': s['expired'], 'failed': s['failed'],
+                             'queued': len(self.queues.get(device, ())), 'in_flight': self.running.get(device, 0),
+                             'wait_ms': percentiles(s['wait_ms']), 'service_ms': percentiles(s['service_ms'])}
+                    for device, s in self.metrics.items()}
+
+
+scheduler = RecognitionScheduler()
 
 
 @app.route('/upload', methods=['POST'])
@@ -142,34 +354,291 @@ def upload_image():
     """
     try:
         image_bytes = request.data
-        if not image_bytes:
+        repeat = request.headers.get('X-Repeat') == '1'
+        if not image_bytes and not repeat:
             return jsonify({'error': 'No data received'}), 400
+        # Camera che invia: ID dell'ESP32 (X-Device-Id), altrimenti l'indirizzo
+        device = request.headers.get('X-Device-Id') or request.remote_addr
+
+        # Telemetria dell'ESP32-CAM sull'accesso precedente (telemetry.py)
+        log_telemetry(from_headers(request.headers), device)
+        if request.headers.get('X-Heap'):
+            record_heap(device, request.headers['X-Heap'])
+
+        if repeat:
+            access = repeat_access(device)
+            if access is None:
+                return jsonify({'status': 'resend'}), 409
+            result, name_or_msg, _, server_ms = access
+        else:
+            face_crop = request.headers.get('X-Face-Crop') == '1'
+            try:
+                result, name_or_msg, _, server_ms = scheduler.run(device, process_access, image_bytes, face_crop, device)
+            except SchedulerBusy as e:
+                return jsonify({'status': 'not ok', 'reason': f'server occupato: {e}'}), 503
+        recognized = result['recognized']
 
-        # Salva immagine ricevuta con timestamp
-        timestamp = datetime.now().strftime("%Y%m%d_%H%M%S")
-        image_path = os.path.join(UPLOAD_FOLDER, f"image_{timestamp}.jpg")
-        image = Image.open(io.BytesIO(image_bytes))
-        image.save(image_path)
-
-        # Riconoscimento facciale
-        recognized, name_or_msg = recognize_face(image_bytes)
-        result = {
-            'timestamp': timestamp,
-            'filename': f"image_{timestamp}.jpg",
-            'recognized': recognized,
-            'name': name_or_msg if recognized else "Unknown"
-        }
-        access_log.append(result)
-
+        # Il tempo di riconoscimento permette all'ESP32 di separare rete e server
+        headers = {'X-Server-Time-Ms': str(server_ms)}
         if recognized:
-            return jsonify({'status': 'ok', 'name': name_or_msg}), 200
+            return jsonify({'status': 'ok', 'name': name_or_msg}), 200, headers
         else:
-            return jsonify({'status': 'not ok', 'reason': name_or_msg}), 200
+            return jsonify({'status': 'not ok', 'reason': name_or_msg}), 200, headers
 
     except Exception as e:
         return jsonify({'error': 'File non valido o danneggiato', 'detail': str(e)}), 400
     
 
+# ============================================
+# CANALE BINARIO ESP32-CAM
+# ============================================
+# Formato definito in PROGETTO-CAM/protocol.h: richiesta con header di 20 byte
+# + meta testuale + JPEG, risposta fissa di 16 byte. Little-endian.
+
+BIN_PORT = 5001
+BIN_VERSION = 1
+BIN_REQUEST = struct.Struct('<2sBBIHBBHHI')   # magic, version, type, device_id, request_id, flags, -, meta_len, -, payload_len
+BIN_REPLY = struct.Struct('<2sBBHBBHHHH')     # magic, version, type, request_id, verdict, config_key, score, user_id, server_ms, config_value
+BIN_IMAGE, BIN_PING, BIN_STATS = 0x01, 0x02, 0x03
+BIN_VERDICT, BIN_PONG, BIN_CONFIG = 0x81, 0x82, 0x83
+BIN_FLAG_FACE_CROP, BIN_FLAG_REPEAT = 0x01, 0x02
+BIN_SCORE_NO_FACE = 0xFFFF
+BIN_VERDICT_RESEND = b'R'
+BIN_CONFIG_KEYS = {'adapt_target_ms': 1, 'adapt_enabled': 2, 'dedup_enabled': 4}
+BIN_CFG_STATS_REQUEST = 3
+STAGE_NAMES = ('frame', 'connect', 'upload', 'server', 'reply', 'total')
+BIN_MAX_PAYLOAD = app.config['MAX_CONTENT_LENGTH']
+
+# Camere collegate al canale binario: device_id -> (socket, lock di scrittura)
+connected_devices = {}
+connected_devices_lock = threading.Lock()
+
+# Riepiloghi di latenza richiesti alle camere: device_id -> Event / ultimo riepilogo
+latency_waiters = {}
+latency_summaries = {}
+
+# Heap interno delle camere (libero/minimo/blocco più grande), dall'ultimo upload
+device_heap = {}
+
+
+def record_heap(device, value):
+    """Salva il watermark dell'heap di una camera; stampa quando il minimo scende"""
+    try:
+        free_bytes, minimum, largest = (int(v) for v in value.split('/'))
+    except ValueError:
+        return
+    previous = device_heap.get(device)
+    device_heap[device] = {'free': free_bytes, 'min': minimum, 'largest_block': largest}
+    if previous is None or minimum < previous['min']:
+        print(f"[HEAP] {device} libero={free_bytes} minimo={minimum} blocco_max={largest}")
+
+
+def recv_exact(sock, size):
+    """Legge esattamente size byte, None se la connessione si chiude"""
+    data = bytearray()
+    while len(data) < size:
+        chunk = sock.recv(size - len(data))
+        if not chunk:
+            return None
+        data.extend(chunk)
+    return bytes(data)
+
+
+def bin_reply(frame_type, request_id=0, verdict=b'N', score=BIN_SCORE_NO_FACE, user_id=0, server_ms=0,
+              config_key=0, config_value=0):
+    return BIN_REPLY.pack(b'SH', BIN_VERSION, frame_type, request_id, verdict[0], config_key,
+                          score, user_id, min(server_ms, 0xFFFF), config_value)
+
+
+def parse_meta(meta):
+    """Telemetria 'chiave=valore;...' allegata dall'ESP32"""
+    pairs = (item.split('=', 1) for item in meta.decode('ascii', 'replace').split(';') if '=' in item)
+    return {key: value for key, value in pairs}
+
+
+class BinaryChannelHandler(socketserver.BaseRequestHandler):
+    """Una connessione persistente per camera: richieste in sequenza, verdetti con layout fisso"""
+
+    def handle(self):
+        sock = self.request
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        write_lock = threading.Lock()
+        device_id = None
+        try:
+            while True:
+                header = recv_exact(sock, BIN_REQUEST.size)
+                if header is None:
+                    break
+                magic, version, frame_type, dev, request_id, flags, _, meta_len, _, payload_len = BIN_REQUEST.unpack(header)
+                if magic != b'SH' or version != BIN_VERSION or payload_len > BIN_MAX_PAYLOAD:
+                    print(f"[BIN] frame non valido da {self.client_address[0]}, connessione chiusa")
+                    break
+                if device_id != dev:
+                    device_id = dev
+                    with connected_devices_lock:
+                        connected_devices[device_id] = (sock, write_lock)
+
+                meta = recv_exact(sock, meta_len) if meta_len else b''
+                payload = recv_exact(sock, payload_len) if payload_len else b''
+                if meta is None or payload is None:
+                    break
+
+                if frame_type == BIN_PING:
+                    reply = bin_reply(BIN_PONG)
+                elif frame_type == BIN_STATS:
+                    self.handle_stats(device_id, parse_meta(meta))
+                    continue
+                elif frame_type == BIN_IMAGE:
+                    reply = self.handle_image(device_id, request_id, flags, parse_meta(meta), payload)
+                else:
+                    continue
+                with write_lock:
+                    sock.sendall(reply)
+        except (OSError, struct.error) as e:
+            print(f"[BIN] connessione {self.client_address[0]} interrotta: {e}")
+        finally:
+            with connected_devices_lock:
+                if device_id is not None and connected_devices.get(device_id, (None,))[0] is sock:
+                    del connected_devices[device_id]
+
+    def handle_stats(self, device_id, meta):
+        latency_summaries[device_id] = parse_latency_summary(meta)
+        event = latency_waiters.get(device_id)
+        if event is not None:
+            event.set()
+
+    def handle_image(self, device_id, request_id, flags, meta, payload):
+        log_telemetry(meta, f"{device_id:08x}")
+        if 'heap' in meta:
+            record_heap(f"{device_id:08x}", meta['heap'])
+        device = f"{device_id:08x}"
+        try:
+            if flags & BIN_FLAG_REPEAT:
+                access = repeat_access(device)
+                if access is None:
+                    return bin_reply(BIN_VERDICT, request_id, BIN_VERDICT_RESEND)
+                result, name, distance, server_ms = access
+            else:
+                result, name, distance, server_ms = scheduler.run(device, process_access, payload,
+                                                                  bool(flags & BIN_FLAG_FACE_CROP), device)
+        except SchedulerBusy:
+            return bin_reply(BIN_VERDICT, request_id)
+        except Exception as e:
+            print(f"[BIN] immagine non valida da {device_id:08x}: {e}")
+            return bin_reply(BIN_VERDICT, request_id)
+
+        user_id = 0
+        if result['recognized']:
+            with app.app_context():
+                user = User.query.filter_by(username=name).first()
+                user_id = user.id if user else 0
+        score = BIN_SCORE_NO_FACE if distance is None else min(int(distance * 1000), BIN_SCORE_NO_FACE - 1)
+        return bin_reply(BIN_VERDICT, request_id, b'Y' if result['recognized'] else b'N', score, user_id, server_ms)
+
+
+def push_config(device_id, key, value):
+    """Invia un frame di configurazione a una camera collegata; False se non è connessa"""
+    with connected_devices_lock:
+        entry = connected_devices.get(device_id)
+    if entry is None:
+        return False
+    sock, write_lock = entry
+    with write_lock:
+        sock.sendall(bin_reply(BIN_CONFIG, config_key=key, config_value=value))
+    return True
+
+
+def parse_latency_summary(meta):
+    """Converte il riepilogo BIN_STATS ('frame=n/p50/p95/max;frame_hist=...') in un dizionario"""
+    summary = {'buckets_ms': [int(b) for b in meta.get('buckets', '').split(',') if b]}
+    for stage in STAGE_NAMES:
+        if stage not in meta:
+            continue
+        count, p50, p95, worst = (int(v) for v in meta[stage].split('/'))
+        hist = [int(c) for c in meta.get(f'{stage}_hist', '').split(',') if c]
+        summary[stage] = {'count': count, 'p50_ms': p50, 'p95_ms': p95, 'max_ms': worst, 'hist': hist}
+    # salute dei server visti dalla camera: 'nome/media/scarto/errori/vinti/duplicati,...'
+    servers = []
+    for entry in meta.get('servers', '').split(','):
+        fields = entry.split('/')
+        if len(fields) == 6:
+            ewma, dev, failures, wins, hedges = (int(v) for v in fields[1:])
+            servers.append({'name': fields[0], 'ewma_ms': ewma, 'dev_ms': dev, 'failures': failures,
+                            'wins': wins, 'hedges': hedges})
+    if servers:
+        summary['servers'] = servers
+    return summary
+
+
+def request_latency_summary(device_id, timeout=3.0):
+    """Chiede il riepilogo di latenza a una camera e attende la risposta; None se non arriva"""
+    event = threading.Event()
+    latency_waiters[device_id] = event
+    try:
+        if not push_config(device_id, BIN_CFG_STATS_REQUEST, 0) or not event.wait(timeout):
+            return None
+        return latency_summaries.get(device_id)
+    finally:
+        latency_waiters.pop(device_id, None)
+
+
+def start_binary_channel(host, port=BIN_PORT):
+    """Avvia il server TCP del canale binario in un thread in background"""
+    socketserver.ThreadingTCPServer.allow_reuse_address = True
+    server = socketserver.ThreadingTCPServer((host, port), BinaryChannelHandler)
+    server.daemon_threads = True
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    print(f"[INFO] Canale binario ESP32-CAM su {host}:{port}")
+    return server
+
+
+@app.route('/api/device/<int:device_id>/config', methods=['POST'])
+@login_required
+def device_config(device_id):
+    """Invia configurazione a una camera sul canale binario, es. {"key": "adapt_target_ms", "value": 1500}"""
+    data = request.get_json(silent=True) or {}
+    key = BIN_CONFIG_KEYS.get(data.get('key'))
+    value = data.get('value')
+    if key is None or not isinstance(value, int) or not 0 <= value <= 0xFFFF:
+        return jsonify({'success': False, 'message': 'Chiave o valore non validi'}), 400
+    if not push_config(device_id, key, value):
+        return jsonify({'success': False, 'message': 'Camera non connessa'}), 404
+    return jsonify({'success': True}), 200
+
+
+@app.route('/api/device/<int:device_id>/latency')
+@login_required
+def device_latency(device_id):
+    """Latenze per stadio (trigger, frame, connessione, upload, server, risposta UART) misurate dalla camera"""
+    summary = request_latency_summary(device_id)
+    if summary is None:
+        return jsonify({'success': False, 'message': 'Camera non connessa o nessuna risposta'}), 404
+    device = f"{device_id:08x}"
+    return jsonify({'success': True, 'device': device, 'stages': summary, 'heap': device_heap.get(device)}), 200
+
+
+@app.route('/api/devices')
+@login_required
+def list_devices():
+    """Camere collegate al canale binario"""
+    with connected_devices_lock:
+        return jsonify([f"{device_id:08x}" for device_id in connected_devices])
+
+
+@app.route('/api/devices/metrics')
+@login_required
+def devices_metrics():
+    """Code e latenze dello scheduler per ogni camera (HTTP e canale binario)"""
+    return jsonify({'workers': RECOGNITION_WORKERS, 'max_in_flight': DEVICE_MAX_IN_FLIGHT,
+                    'max_queued': DEVICE_MAX_QUEUED, 'devices': scheduler.snapshot()})
+
+
+@app.route('/ping')
+def ping():
+    """Health check usato dall'ESP32-CAM per tenere viva la connessione persistente"""
+    return 'ok', 200
+
+
 @app.route('/')
 def index():
     """Route principale per la homepage"""
@@ -278,9 +747,9 @@ def register_page():
                     os.remove(face_path)
                     return jsonify({'success': False, 'message': 'Nessun volto rilevato nella foto'}), 400
 
-                # Aggiorna subito i volti noti in memoria
-                known_face_encodings.append(encodings[0])
-                known_face_names.append(username)
+                # Aggiorna subito i volti noti in memoria e su disco
+                known_faces.add(username, encodings[0])
+                known_faces.save(FACE_INDEX_PATH)
 
             except Exception as e:
                 if os.path.exists(face_path):
@@ -308,4 +777,7 @@ def logout():
     return redirect(url_for('index'))
 
 if __name__ == '__main__':
-    app.run(host='172.20.10.2', port=5000)
+    # HTTP/1.1: il server tiene aperta la connessione keep-alive dell'ESP32-CAM
+    WSGIRequestHandler.protocol_version = "HTTP/1.1"
+    start_binary_channel('172.20.10.2')
+    app.run(host='172.20.10.2', port=5000, threaded=True)
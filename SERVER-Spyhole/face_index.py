@@ -0,0 +1,617 @@
+"""
+Indici degli encoding dei volti noti (vettori a 128 dimensioni di face_recognition).
+
+Due implementazioni con la stessa interfaccia (add/remove/search/save):
+  ExactIndex  confronto con tutti i volti, un prodotto matrice-vettore. Va bene
+              fino a qualche decina di migliaia di volti.
+  IVFIndex    approssimato: k-means divide gli encoding in liste e ogni ricerca
+              confronta solo le liste dei NPROBE centroidi più vicini. Serve per
+              popolazioni grandi (100.000+ identità).
+
+Inserimenti e cancellazioni sono incrementali (nessuna ricostruzione); IVFIndex
+si riaddestra da solo quando i volti crescono di IVF_RETRAIN_GROWTH volte
+dall'ultimo addestramento. Su disco l'indice è un .npz (nomi, vettori e per
+IVF centroidi e liste), scritto in un file temporaneo e poi rinominato.
+
+Le distanze le calcola il kernel nativo native/libfacedist.so (AVX2/AVX-512
+scelto a runtime, 4 righe alla volta, uscita anticipata a metà delle
+dimensioni quando le righe superano già la migliore trovata o la soglia) se è
+stato compilato con "make -C native"; altrimenti un prodotto matrice-vettore
+di numpy.
+
+Benchmark di recall e latenza dell'indice approssimato rispetto a quello
+esatto, alla soglia di riconoscimento, su encoding sintetici, e del kernel
+nativo rispetto a face_recognition.face_distance e a numpy:
+
+    python3 face_index.py --bench --faces 100000 --queries 2000
+    python3 face_index.py --bench-native --faces 10000
+"""
+
+import argparse
+import ctypes
+import os
+import threading
+import time
+
+import numpy as np
+
+FACE_ENCODING_DIM = 128
+INDEX_FORMAT_VERSION = 1
+
+IVF_TRAIN_MIN = 4096        # sotto questa soglia IVFIndex cerca su tutti i volti
+IVF_RETRAIN_GROWTH = 4      # riaddestra quando i volti crescono di tanto
+IVF_LIST_SIZE = 64          # volti per lista attesi dopo l'addestramento
+IVF_NPROBE = 16             # liste confrontate per ricerca
+IVF_KMEANS_ITERATIONS = 8
+IVF_KMEANS_SAMPLE = 64      # punti per centroide usati per l'addestramento
+CHUNK_ROWS = 8192           # righe per blocco nelle distanze molti-a-molti
+
+NATIVE_PATH = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'native', 'libfacedist.so')
+NATIVE_ISA_NAMES = ('scalare', 'avx2', 'avx512')
+
+
+def load_native(path=NATIVE_PATH, scalar=False):
+    """
+    Kernel nativo delle distanze (native/facedist.cpp), None se non è compilato.
+    Su una CPU senza AVX2 il kernel scalare è più lento del prodotto
+    matrice-vettore di numpy (BLAS vettorizzato): si usa solo con scalar=True.
+    """
+    try:
+        lib = ctypes.CDLL(path)
+    except OSError:
+        return None
+    # puntatori grezzi (array.ctypes.data): ndpointer costa qualche µs a chiamata
+    ptr, length = ctypes.c_void_p, ctypes.c_long
+    lib.faceDistIsa.restype = ctypes.c_int
+    lib.faceDistUseIsa.argtypes = [ctypes.c_int]
+    lib.faceDistUseIsa.restype = ctypes.c_int
+    lib.faceDistL2.argtypes = [ptr, length, length, ptr, ptr]
+    lib.faceDistL2.restype = None
+    lib.faceDistNearest.argtypes = [ptr, length, length, ptr, ctypes.c_float, ctypes.POINTER(ctypes.c_float)]
+    lib.faceDistNearest.restype = length
+    lib.faceDistTopK.argtypes = [ptr, length, length, ptr, length, ctypes.c_float, ptr, ptr]
+    lib.faceDistTopK.restype = length
+    return lib if scalar or lib.faceDistIsa() > 0 else None
+
+
+native = load_native()
+
+
+class _Rows:
+    """
+    Blocco di encoding float32 contiguo, preallocato e raddoppiato quando è
+    pieno, con le norme al quadrato e l'id di ogni riga. La cancellazione sposta
+    l'ultima riga nel buco, così le righe restano contigue.
+    """
+
+    def __init__(self, capacity=64):
+        self.count = 0
+        self.matrix = np.zeros((capacity, FACE_ENCODING_DIM), dtype=np.float32)
+        self.norms = np.zeros(capacity, dtype=np.float32)
+        self.ids = np.zeros(capacity, dtype=np.int64)
+        self.scores = np.empty(capacity, dtype=np.float32)
+        self.best = ctypes.c_float()
+
+    def _grow(self):
+        capacity = 2 * len(self.matrix)
+        for field in ('matrix', 'norms', 'ids'):
+            old = getattr(self, field)
+            new = np.zeros((capacity,) + old.shape[1:], dtype=old.dtype)
+            new[:self.count] = old[:self.count]
+            setattr(self, field, new)
+        self.scores = np.empty(capacity, dtype=np.float32)
+
+    def append(self, face_id, vector):
+        """Aggiunge una riga e ne ritorna la posizione"""
+        if self.count == len(self.matrix):
+            self._grow()
+        row = self.count
+        self.count += 1
+        self.set(row, face_id, vector)
+        return row
+
+    def set(self, row, face_id, vector):
+        self.matrix[row] = vector
+        self.norms[row] = np.dot(self.matrix[row], self.matrix[row])
+        self.ids[row] = face_id
+
+    def pop(self, row):
+        """Toglie una riga; ritorna l'id spostato al suo posto (o None)"""
+        last = self.count - 1
+        self.count = last
+        if row == last:
+            return None
+        self.matrix[row] = self.matrix[last]
+        self.norms[row] = self.norms[last]
+        self.ids[row] = self.ids[last]
+        return int(self.ids[row])
+
+    def nearest(self, query, query_norm, bound=np.inf):
+        """
+        Riga più vicina a query con distanza al quadrato sotto bound, come
+        (distanza², id); None se non ce n'è. Con il kernel nativo le righe si
+        abbandonano appena superano la migliore; con numpy è un prodotto
+        matrice-vettore nel buffer riusato (||k||² - 2·k·q + ||q||²).
+        """
+        n = self.count
+        if not n:
+            return None
+        if native is not None:
+            row = native.faceDistNearest(self.matrix.ctypes.data, n, FACE_ENCODING_DIM, query.ctypes.data,
+                                         bound, ctypes.byref(self.best))
+            return (self.best.value, int(self.ids[row])) if row >= 0 else None
+        scores = self.scores[:n]
+        np.dot(self.matrix[:n], query, out=scores)
+        scores *= -2.0
+        scores += self.norms[:n]
+        best = int(scores.argmin())
+        squared = max(float(scores[best]) + query_norm, 0.0)
+        return (squared, int(self.ids[best])) if squared < bound else None
+
+    def nearest_k(self, query, query_norm, k, bound=np.inf):
+        """Le k righe più vicine sotto bound, [(distanza², id), ...] in ordine crescente"""
+        n = self.count
+        if not n:
+            return []
+        if native is not None:
+            ids = np.empty(k, dtype=np.int64)
+            squared = np.empty(k, dtype=np.float32)
+            found = native.faceDistTopK(self.matrix.ctypes.data, n, FACE_ENCODING_DIM, query.ctypes.data, k, bound,
+                                        ids.ctypes.data, squared.ctypes.data)
+            return [(float(squared[i]), int(self.ids[ids[i]])) for i in range(found)]
+        scores = self.scores[:n]
+        np.dot(self.matrix[:n], query, out=scores)
+        scores *= -2.0
+        scores += self.norms[:n]
+        rows = np.argpartition(scores, k - 1)[:k] if k < n else np.arange(n)
+        found = sorted((max(float(scores[row]) + query_norm, 0.0), int(self.ids[row])) for row in rows)
+        return [entry for entry in found if entry[0] < bound]
+
+
+class FaceIndex:
+    """
+    Interfaccia comune: un volto per nome, add() sostituisce l'encoding di un
+    nome già presente. Gli id sono posizioni in self.names riusate dopo le
+    cancellazioni. Tutti i metodi passano da self.lock (i buffer di ricerca
+    sono condivisi tra i thread di riconoscimento).
+    """
+
+    kind = None
+
+    def __init__(self):
+        self.lock = threading.RLock()
+        self.names = []                 # id -> nome (None se libero)
+        self.ids = {}                   # nome -> id
+        self.free_ids = []
+        self.query = np.empty(FACE_ENCODING_DIM, dtype=np.float32)
+
+    def __len__(self):
+        return len(self.ids)
+
+    def __contains__(self, name):
+        return name in self.ids
+
+    def add(self, name, encoding):
+        with self.lock:
+            vector = np.asarray(encoding, dtype=np.float32).reshape(FACE_ENCODING_DIM)
+            face_id = self.ids.get(name)
+            if face_id is not None:
+                self._remove(face_id)
+            elif self.free_ids:
+                face_id = self.free_ids.pop()
+            else:
+                face_id = len(self.names)
+                self.names.append(None)
+            self.names[face_id] = name
+            self.ids[name] = face_id
+            self._insert(face_id, vector)
+
+    def remove(self, name):
+        """Toglie un volto; False se non c'era"""
+        with self.lock:
+            face_id = self.ids.pop(name, None)
+            if face_id is None:
+                return False
+            self._remove(face_id)
+            self.names[face_id] = None
+            self.free_ids.append(face_id)
+            return True
+
+    def search(self, encoding, max_distance=None):
+        """
+        Volto noto più vicino: (nome, distanza). (None, None) se l'indice è
+        vuoto o, con max_distance, se nessun volto è più vicino di così (le
+        righe oltre il limite si scartano prima di finire il calcolo).
+        """
+        with self.lock:
+            query = self.query
+            query[:] = encoding
+            bound = np.inf if max_distance is None else max_distance ** 2
+            best = self._nearest(query, float(np.dot(query, query)), bound)
+            if best is None:
+                return None, None
+            squared, face_id = best
+            return self.names[face_id], squared ** 0.5
+
+    def search_k(self, encoding, k, max_distance=None):
+        """I k volti noti più vicini: [(nome, distanza), ...] in ordine crescente"""
+        with self.lock:
+            query = self.query
+            query[:] = encoding
+            bound = np.inf if max_distance is None else max_distance ** 2
+            found = self._nearest_k(query, float(np.dot(query, query)), k, bound)
+            return [(self.names[face_id], squared ** 0.5) for squared, face_id in found]
+
+    def vectors(self):
+        """(nomi, matrice n x 128) di tutti i volti, nell'ordine delle righe"""
+        raise NotImplementedError
+
+    def save(self, path):
+        """Scrive l'indice in path (.npz), atomicamente"""
+        with self.lock:
+            names, matrix = self.vectors()
+            arrays = {'version': np.array(INDEX_FORMAT_VERSION), 'kind': np.array(self.kind),
+                      'names': np.array(names, dtype=str), 'vectors': matrix}
+            arrays.update(self._extra_arrays(names))
+            tmp_path = path + '.tmp'
+            with open(tmp_path, 'wb') as f:
+                np.savez(f, **arrays)
+            os.replace(tmp_path, path)
+
+    def _extra_arrays(self, names):
+        return {}
+
+
+class ExactIndex(FaceIndex):
+    """Confronto con tutti i volti: un solo blocco contiguo"""
+
+    kind = 'exact'
+
+    def __init__(self, capacity=64):
+        super().__init__()
+        self.rows = _Rows(capacity)
+        self.row_of = {}                # id -> riga
+
+    def _insert(self, face_id, vector):
+        self.row_of[face_id] = self.rows.append(face_id, vector)
+
+    def _remove(self, face_id):
+        row = self.row_of.pop(face_id)
+        moved = self.rows.pop(row)
+        if moved is not None:
+            self.row_of[moved] = row    # l'ultima riga ora sta nel posto lasciato libero
+
+    def _nearest(self, query, query_norm, bound):
+        return self.rows.nearest(query, query_norm, bound)
+
+    def _nearest_k(self, query, query_norm, k, bound):
+        return self.rows.nearest_k(query, query_norm, k, bound)
+
+    def vectors(self):
+        n = self.rows.count
+        return [self.names[i] for i in self.rows.ids[:n]], self.rows.matrix[:n].copy()
+
+    @classmethod
+    def from_arrays(cls, names, vectors, arrays):
+        index = cls(capacity=max(64, len(names)))
+        for name, vector in zip(names, vectors):
+            index.add(str(name), vector)
+        return index
+
+
+def _squared_distances(points, centroids, centroid_norms):
+    """||p - c||² a meno di ||p||² (costante per riga), per blocchi di CHUNK_ROWS righe"""
+    for start in range(0, len(points), CHUNK_ROWS):
+        block = points[start:start + CHUNK_ROWS]
+        yield start, centroid_norms[None, :] - 2.0 * (block @ centroids.T)
+
+
+def _assign(points, centroids):
+    """Centroide più vicino di ogni punto"""
+    norms = np.einsum('ij,ij->i', centroids, centroids)
+    labels = np.empty(len(points), dtype=np.int64)
+    for start, scores in _squared_distances(points, centroids, norms):
+        labels[start:start + len(scores)] = scores.argmin(axis=1)
+    return labels
+
+
+def kmeans(points, k, iterations=IVF_KMEANS_ITERATIONS, seed=0):
+    """k-means di Lloyd; i centroidi rimasti vuoti ripartono da un punto a caso"""
+    rng = np.random.default_rng(seed)
+    centroids = points[rng.choice(len(points), k, replace=False)].copy()
+    for _ in range(iterations):
+        labels = _assign(points, centroids)
+        sums = np.zeros_like(centroids)
+        np.add.at(sums, labels, points)
+        counts = np.bincount(labels, minlength=k)
+        empty = counts == 0
+        centroids = sums / np.maximum(counts, 1)[:, None]
+        if empty.any():
+            centroids[empty] = points[rng.choice(len(points), int(empty.sum()), replace=False)]
+    return centroids.astype(np.float32)
+
+
+class IVFIndex(FaceIndex):
+    """
+    Inverted file: ogni volto sta nella lista del suo centroide più vicino e la
+    ricerca confronta solo le nprobe liste più vicine alla query. Finché non è
+    addestrato c'è un'unica lista e la ricerca è esatta.
+    """
+
+    kind = 'ivf'
+
+    def __init__(self, nprobe=IVF_NPROBE, train_min=IVF_TRAIN_MIN):
+        super().__init__()
+        self.nprobe = nprobe
+        self.train_min = train_min
+        self.trained_count = 0
+        self._set_centroids(np.zeros((1, FACE_ENCODING_DIM), dtype=np.float32))
+        self.location = {}              # id -> (lista, riga)
+
+    def _set_centroids(self, centroids):
+        self.centroids = centroids
+        self.centroid_norms = np.einsum('ij,ij->i', centroids, centroids)
+        self.centroid_scores = np.empty(len(centroids), dtype=np.float32)
+        self.lists = [_Rows(16) for _ in range(len(centroids))]
+
+    def _list_for(self, vector):
+        if len(self.lists) == 1:
+            return 0
+        scores = self.centroid_scores
+        np.dot(self.centroids, vector, out=scores)
+        scores *= -2.0
+        scores += self.centroid_norms
+        return int(scores.argmin())
+
+    def _insert(self, face_id, vector):
+        target = self._list_for(vector)
+        self.location[face_id] = (target, self.lists[target].append(face_id, vector))
+        if len(self.location) >= max(self.train_min, IVF_RETRAIN_GROWTH * self.trained_count):
+            self.train()
+
+    def _remove(self, face_id):
+        target, row = self.location.pop(face_id)
+        moved = self.lists[target].pop(row)
+        if moved is not None:
+            self.location[moved] = (target, row)
+
+    def _probed_lists(self, query):
+        """Le nprobe liste con il centroide più vicino a query"""
+        if len(self.lists) == 1:
+            return self.lists
+        scores = self.centroid_scores
+        np.dot(self.centroids, query, out=scores)
+        scores *= -2.0
+        scores += self.centroid_norms
+        nprobe = min(self.nprobe, len(scores))
+        return [self.lists[target] for target in np.argpartition(scores, nprobe - 1)[:nprobe]]
+
+    def _nearest(self, query, query_norm, bound):
+        best = None
+        for rows in self._probed_lists(query):
+            found = rows.nearest(query, query_norm, bound)
+            if found is not None:
+                best, bound = found, found[0]   # le liste successive devono fare meglio
+        return best
+
+    def _nearest_k(self, query, query_norm, k, bound):
+        found = []
+        for rows in self._probed_lists(query):
+            found = sorted(found + rows.nearest_k(query, query_norm, k, bound))[:k]
+            if len(found) == k:
+                bound = found[-1][0]
+        return found
+
+    def train(self, centroids=None, labels=None):
+        """
+        Ricalcola i centroidi (k-means su un campione, IVF_LIST_SIZE volti per
+        lista) e ridistribuisce tutti i volti. Con centroids/labels dati (da
+        disco) ricostruisce le liste senza rifare il k-means.
+        """
+        with self.lock:
+            names, matrix = self.vectors()
+            ids = [self.ids[name] for name in names]
+            if centroids is None:
+                k = max(1, len(matrix) // IVF_LIST_SIZE)
+                rng = np.random.default_rng(len(matrix))
+                sample_size = min(len(matrix), k * IVF_KMEANS_SAMPLE)
+                sample = matrix[rng.choice(len(matrix), sample_size, replace=False)]
+                centroids = kmeans(sample, k)
+            if labels is None:
+                labels = _assign(matrix, centroids)
+            self._set_centroids(centroids)
+            self.location = {}
+            for face_id, label, vector in zip(ids, labels, matrix):
+                self.location[face_id] = (int(label), self.lists[label].append(face_id, vector))
+            self.trained_count = len(matrix)
+
+    def vectors(self):
+        names, blocks = [], []
+        for rows in self.lists:
+            names.extend(self.names[i] for i in rows.ids[:rows.count])
+            blocks.append(rows.matrix[:rows.count])
+        matrix = np.concatenate(blocks) if blocks else np.zeros((0, FACE_ENCODING_DIM), dtype=np.float32)
+        return names, matrix
+
+    def _extra_arrays(self, names):
+        labels = np.array([self.location[self.ids[name]][0] for name in names], dtype=np.int32)
+        return {'centroids': self.centroids, 'labels': labels, 'trained_count': np.array(self.trained_count)}
+
+    @classmethod
+    def from_arrays(cls, names, vectors, arrays):
+        index = cls()
+        for face_id, name in enumerate(names):
+            index.names.append(str(name))
+            index.ids[str(name)] = face_id
+        index._set_centroids(arrays['centroids'])
+        labels = arrays['labels']
+        for face_id, (label, vector) in enumerate(zip(labels, vectors)):
+            index.location[face_id] = (int(label), index.lists[label].append(face_id, vector))
+        index.trained_count = int(arrays['trained_count'])
+        return index
+
+
+INDEX_KINDS = {'exact': ExactIndex, 'ivf': IVFIndex}
+
+
+def open_index(kind, path=None):
+    """
+    Indice del tipo richiesto, caricato da path se c'è. Se il file è di un
+    altro tipo (es. si è passati da exact a ivf) i volti vengono reinseriti
+    nel nuovo indice.
+    """
+    cls = INDEX_KINDS[kind]
+    if not path or not os.path.exists(path):
+        return cls()
+    with np.load(path, allow_pickle=False) as arrays:
+        if int(arrays['version']) != INDEX_FORMAT_VERSION:
+            return cls()
+        names, vectors = arrays['names'], arrays['vectors']
+        if str(arrays['kind']) == kind:
+            return cls.from_arrays(names, vectors, arrays)
+    index = cls()
+    for name, vector in zip(names, vectors):
+        index.add(str(name), vector)
+    return index
+
+
+# ============================================
+# BENCHMARK
+# ============================================
+
+def synthetic_faces(count, rng):
+    """
+    Encoding sintetici con la scala di face_recognition: identità diverse a
+    distanza ~0.9 tra loro, raggruppate in qualche centinaio di "tipi" come i
+    volti veri (non uniformi nello spazio)
+    """
+    groups = rng.normal(0, 0.055, (max(1, count // 500), FACE_ENCODING_DIM))
+    members = rng.normal(0, 0.055, (count, FACE_ENCODING_DIM))
+    return (groups[rng.integers(0, len(groups), count)] + members).astype(np.float32)
+
+
+def synthetic_queries(enrolled, count, rng):
+    """Metà foto nuove di utenti registrati (distanza ~0.3), metà estranei"""
+    known = rng.integers(0, len(enrolled), count // 2)
+    noise = rng.normal(0, 0.3 / np.sqrt(FACE_ENCODING_DIM), (len(known), FACE_ENCODING_DIM))
+    return np.concatenate([enrolled[known] + noise, synthetic_faces(count - len(known), rng)]).astype(np.float32)
+
+
+def run_benchmark(faces, queries, threshold, nprobe, seed=0):
+    rng = np.random.default_rng(seed)
+    enrolled = synthetic_faces(faces, rng)
+    names = [f'user{i}' for i in range(faces)]
+    probes = synthetic_queries(enrolled, queries, rng)
+
+    results = {}
+    for index in (ExactIndex(), IVFIndex(nprobe=nprobe)):
+        start = time.perf_counter()
+        for name, vector in zip(names, enrolled):
+            index.add(name, vector)
+        build_s = time.perf_counter() - start
+        answers, times = [], []
+        for probe in probes:
+            start = time.perf_counter()
+            answers.append(index.search(probe))
+            times.append(time.perf_counter() - start)
+        times = np.array(times) * 1000
+        results[index.kind] = answers
+        print(f"{index.kind:<6} volti={len(index)} costruzione={build_s:.2f} s "
+              f"ricerca p50={np.percentile(times, 50):.3f} ms p95={np.percentile(times, 95):.3f} ms "
+              f"max={times.max():.3f} ms")
+
+    def decisions(answers):
+        return [name if distance < threshold else None for name, distance in answers]
+
+    exact, approx = decisions(results['exact']), decisions(results['ivf'])
+    matched = [i for i, name in enumerate(exact) if name is not None]
+    recall = sum(approx[i] == exact[i] for i in matched) / max(1, len(matched))
+    agree = sum(a == e for a, e in zip(approx, exact)) / len(exact)
+    nearest = sum(a[0] == e[0] for a, e in zip(results['ivf'], results['exact'])) / len(exact)
+    print(f"soglia={threshold} riconosciuti(exact)={len(matched)}/{len(exact)} recall@soglia={recall:.4f} "
+          f"decisioni uguali={agree:.4f} vicino esatto trovato={nearest:.4f}")
+
+
+def _timed(label, fn, probes, expected):
+    """Esegue fn su ogni query e stampa latenza e quante risposte coincidono con expected (se c'è)"""
+    fn(probes[0])
+    answers, times = [], []
+    for probe in probes:
+        start = time.perf_counter()
+        answers.append(fn(probe))
+        times.append(time.perf_counter() - start)
+    times = np.array(times) * 1e6
+    same = '-' if expected is None else f"{sum(a == e for a, e in zip(answers, expected)) / len(expected):.4f}"
+    print(f"{label:<46} p50={np.percentile(times, 50):8.1f} µs p95={np.percentile(times, 95):8.1f} µs uguali={same}")
+    return answers
+
+
+def run_native_benchmark(faces, queries, threshold, seed=0):
+    """Ricerca esatta: face_distance come prima, numpy, kernel nativo per ogni ISA della CPU"""
+    global native
+    kernel = load_native(scalar=True)
+    rng = np.random.default_rng(seed)
+    enrolled = synthetic_faces(faces, rng)
+    probes = synthetic_queries(enrolled, queries, rng)
+    try:
+        import face_recognition
+        face_distance, label = face_recognition.face_distance, 'face_recognition.face_distance'
+    except ImportError:
+        def face_distance(known, query):
+            return np.linalg.norm(np.asarray(known) - query, axis=1)
+        label = 'face_distance (numpy, stessa formula)'
+
+    # come prima: lista di encoding float64 convertita a ogni richiesta
+    known_list = list(enrolled.astype(np.float64))
+    names = [f'user{i}' for i in range(faces)]
+    nearest = _timed(label, lambda q: names[int(np.argmin(face_distance(known_list, q)))], probes, None)
+    decided = [name if np.linalg.norm(enrolled[int(name[4:])] - q) < threshold else None
+               for name, q in zip(nearest, probes)]
+
+    native = None
+    index = ExactIndex(capacity=faces)
+    for name, vector in zip(names, enrolled):
+        index.add(name, vector)
+    _timed('ExactIndex numpy (GEMV)', lambda q: index.search(q)[0], probes, nearest)
+    if kernel is None:
+        print(f"kernel nativo non compilato ({NATIVE_PATH}): make -C native")
+        return
+    native = kernel
+
+    scratch = np.empty(faces, dtype=np.float32)
+    ids, dists = np.empty(5, dtype=np.int64), np.empty(5, dtype=np.float32)
+    matrix = index.rows.matrix
+    for isa in range(native.faceDistUseIsa(len(NATIVE_ISA_NAMES)) + 1):
+        name = NATIVE_ISA_NAMES[native.faceDistUseIsa(isa)]
+        _timed(f'nativo {name}: tutte le distanze (L2)',
+               lambda q: native.faceDistL2(matrix.ctypes.data, faces, FACE_ENCODING_DIM, q.ctypes.data,
+                                           scratch.ctypes.data) or names[int(scratch.argmin())], probes, nearest)
+        _timed(f'nativo {name}: più vicino, uscita anticipata', lambda q: index.search(q)[0], probes, nearest)
+        _timed(f'nativo {name}: soglia {threshold}', lambda q: index.search(q, threshold)[0], probes, decided)
+        _timed(f'nativo {name}: top-5',
+               lambda q: native.faceDistTopK(matrix.ctypes.data, faces, FACE_ENCODING_DIM, q.ctypes.data, 5,
+                                             np.inf, ids.ctypes.data, dists.ctypes.data) and names[int(ids[0])],
+               probes, nearest)
+    native.faceDistUseIsa(len(NATIVE_ISA_NAMES))
+    native = load_native()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--bench', action='store_true', help='confronta IVFIndex con ExactIndex')
+    parser.add_argument('--bench-native', action='store_true', help='confronta il kernel nativo con face_distance')
+    parser.add_argument('--faces', type=int, default=100000, help='volti registrati sintetici')
+    parser.add_argument('--queries', type=int, default=2000)
+    parser.add_argument('--threshold', type=float, default=0.4, help='soglia di riconoscimento (app.py)')
+    parser.add_argument('--nprobe', type=int, default=IVF_NPROBE)
+    args = parser.parse_args()
+    if args.bench_native:
+        run_native_benchmark(args.faces, args.queries, args.threshold)
+    elif args.bench:
+        run_benchmark(args.faces, args.queries, args.threshold, args.nprobe)
+    else:
+        parser.print_help()
+
+
+if __name__ == '__main__':
+    main()
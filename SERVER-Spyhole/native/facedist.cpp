@@ -0,0 +1,228 @@
+// Distanze L2 tra un encoding (128 float) e la matrice dei volti noti, per
+// face_index.py via ctypes. Tre implementazioni dello stesso blocco di 4 righe,
+// scelta a runtime in base alla CPU: AVX-512, AVX2+FMA, scalare. Il resto
+// della libreria (ricerca del minimo, top-k) e' comune e non dipende dall'ISA.
+//
+// Le 4 righe si accumulano insieme (catene di FMA indipendenti, una riduzione
+// sola per le 4 somme). Uscita anticipata: a meta' delle dimensioni, se tutte
+// e 4 le somme parziali superano gia' il limite (la soglia di riconoscimento
+// o la migliore distanza trovata finora) la seconda meta' si salta. Con volti
+// di persone diverse a distanza ~0.9 succede per quasi tutti i blocchi.
+//
+// Le distanze sono al quadrato; le righe sono contigue (stride = dim). Le
+// versioni SIMD vogliono dim multiplo di FACEDIST_SIMD_DIM (128 lo e').
+
+#include <math.h>
+#include <stddef.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FACEDIST_X86 1
+#else
+#define FACEDIST_X86 0                  // es. Raspberry Pi: solo la versione scalare
+#endif
+
+#define FACEDIST_SIMD_DIM 32
+
+enum { ISA_SCALAR, ISA_AVX2, ISA_AVX512 };
+
+// 4 righe consecutive da rows; out[i] e' la distanza, o una somma parziale gia' >= bound
+typedef void (*BlockFn)(const float *rows, long dim, const float *query, float bound, float *out);
+
+static float rowScalar(const float *row, const float *query, long dim, float bound) {
+  float sum = 0;
+  long d = 0;
+  for (; d < dim / 2; d++) sum += (row[d] - query[d]) * (row[d] - query[d]);
+  if (sum >= bound) return sum;
+  for (; d < dim; d++) sum += (row[d] - query[d]) * (row[d] - query[d]);
+  return sum;
+}
+
+static void blockScalar(const float *rows, long dim, const float *query, float bound, float *out) {
+  for (int i = 0; i < 4; i++) out[i] = rowScalar(rows + i * dim, query, dim, bound);
+}
+
+#if FACEDIST_X86
+// [somma(a0), somma(a1), somma(a2), somma(a3)]
+__attribute__((target("avx2,fma"))) static __m128 sum4(__m256 a0, __m256 a1, __m256 a2, __m256 a3) {
+  __m256 t = _mm256_hadd_ps(_mm256_hadd_ps(a0, a1), _mm256_hadd_ps(a2, a3));
+  return _mm_add_ps(_mm256_castps256_ps128(t), _mm256_extractf128_ps(t, 1));
+}
+
+__attribute__((target("avx2,fma"))) static void blockAvx2(const float *rows, long dim, const float *query, float bound, float *out) {
+  const float *r0 = rows, *r1 = rows + dim, *r2 = rows + 2 * dim, *r3 = rows + 3 * dim;
+  __m256 a0 = _mm256_setzero_ps(), a1 = a0, a2 = a0, a3 = a0;
+  long d = 0;
+
+  for (long end = dim / 2;; end = dim) {
+    for (; d < end; d += 8) {
+      __m256 q = _mm256_loadu_ps(query + d);
+      __m256 x0 = _mm256_sub_ps(_mm256_loadu_ps(r0 + d), q);
+      __m256 x1 = _mm256_sub_ps(_mm256_loadu_ps(r1 + d), q);
+      __m256 x2 = _mm256_sub_ps(_mm256_loadu_ps(r2 + d), q);
+      __m256 x3 = _mm256_sub_ps(_mm256_loadu_ps(r3 + d), q);
+      a0 = _mm256_fmadd_ps(x0, x0, a0);
+      a1 = _mm256_fmadd_ps(x1, x1, a1);
+      a2 = _mm256_fmadd_ps(x2, x2, a2);
+      a3 = _mm256_fmadd_ps(x3, x3, a3);
+    }
+    __m128 sums = sum4(a0, a1, a2, a3);
+    _mm_storeu_ps(out, sums);
+    if (d == dim || !_mm_movemask_ps(_mm_cmplt_ps(sums, _mm_set1_ps(bound)))) return;
+  }
+}
+
+// L'estrazione della meta' alta in GCC 12 usa un registro "undefined" e fa
+// scattare -W(maybe-)uninitialized: falso positivo, silenziato solo qui
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+__attribute__((target("avx512f,avx2,fma"))) static __m256 fold512(__m512 v) {
+  return _mm256_add_ps(_mm512_castps512_ps256(v), _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(v), 1)));
+}
+
+__attribute__((target("avx512f,avx2,fma"))) static void blockAvx512(const float *rows, long dim, const float *query, float bound, float *out) {
+  const float *r0 = rows, *r1 = rows + dim, *r2 = rows + 2 * dim, *r3 = rows + 3 * dim;
+  __m512 a0 = _mm512_setzero_ps(), a1 = a0, a2 = a0, a3 = a0;
+  long d = 0;
+
+  for (long end = dim / 2;; end = dim) {
+    for (; d < end; d += 16) {
+      __m512 q = _mm512_loadu_ps(query + d);
+      __m512 x0 = _mm512_sub_ps(_mm512_loadu_ps(r0 + d), q);
+      __m512 x1 = _mm512_sub_ps(_mm512_loadu_ps(r1 + d), q);
+      __m512 x2 = _mm512_sub_ps(_mm512_loadu_ps(r2 + d), q);
+      __m512 x3 = _mm512_sub_ps(_mm512_loadu_ps(r3 + d), q);
+      a0 = _mm512_fmadd_ps(x0, x0, a0);
+      a1 = _mm512_fmadd_ps(x1, x1, a1);
+      a2 = _mm512_fmadd_ps(x2, x2, a2);
+      a3 = _mm512_fmadd_ps(x3, x3, a3);
+    }
+    __m128 sums = sum4(fold512(a0), fold512(a1), fold512(a2), fold512(a3));
+    _mm_storeu_ps(out, sums);
+    if (d == dim || !_mm_movemask_ps(_mm_cmplt_ps(sums, _mm_set1_ps(bound)))) return;
+  }
+}
+#pragma GCC diagnostic pop
+
+static int detectIsa() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return ISA_AVX512;
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return ISA_AVX2;
+  return ISA_SCALAR;
+}
+#else
+#define blockAvx2 blockScalar
+#define blockAvx512 blockScalar
+static int detectIsa() { return ISA_SCALAR; }
+#endif
+
+static const int cpuIsa = detectIsa();
+static int isa = cpuIsa;
+static BlockFn blockFn = cpuIsa == ISA_AVX512 ? blockAvx512 : cpuIsa == ISA_AVX2 ? blockAvx2 : blockScalar;
+
+// Le righe [i, i+4) se ce ne sono 4 e dim va bene per il SIMD, altrimenti una alla volta
+static int distances(const float *rows, long i, long n, long dim, const float *query, float bound, float *out) {
+  if (i + 4 <= n && dim % FACEDIST_SIMD_DIM == 0) {
+    blockFn(rows + i * dim, dim, query, bound, out);
+    return 4;
+  }
+  out[0] = rowScalar(rows + i * dim, query, dim, bound);
+  return 1;
+}
+
+extern "C" {
+
+// ISA in uso: 0 scalare, 1 AVX2, 2 AVX-512
+int faceDistIsa() { return isa; }
+
+// Limita l'ISA (per confrontarle nel benchmark); ritorna quella effettiva
+int faceDistUseIsa(int wanted) {
+  isa = wanted < cpuIsa ? wanted : cpuIsa;
+  if (isa < 0) isa = ISA_SCALAR;
+  blockFn = isa == ISA_AVX512 ? blockAvx512 : isa == ISA_AVX2 ? blockAvx2 : blockScalar;
+  return isa;
+}
+
+// Distanze al quadrato di tutte le n righe, senza uscita anticipata
+void faceDistL2(const float *rows, long n, long dim, const float *query, float *out) {
+  float d[4];
+  for (long i = 0; i < n;) {
+    int got = distances(rows, i, n, dim, query, INFINITY, d);
+    for (int j = 0; j < got; j++) out[i + j] = d[j];
+    i += got;
+  }
+}
+
+// Riga piu' vicina con distanza al quadrato sotto bound (INFINITY = nessun
+// limite); -1 se nessuna. *best = la sua distanza, altrimenti resta bound.
+long faceDistNearest(const float *rows, long n, long dim, const float *query, float bound, float *best) {
+  long found = -1;
+  float d[4];
+  for (long i = 0; i < n;) {
+    int got = distances(rows, i, n, dim, query, bound, d);
+    for (int j = 0; j < got; j++) {
+      if (d[j] < bound) {
+        bound = d[j];
+        found = i + j;
+      }
+    }
+    i += got;
+  }
+  *best = bound;
+  return found;
+}
+
+// Inserisce (d, id) nel max-heap ids/dists di size elementi (capacita' k)
+static void heapPush(long *ids, float *dists, long *size, long k, float d, long id) {
+  long pos;
+  if (*size < k) {
+    pos = (*size)++;                    // risale dal fondo
+    while (pos > 0 && dists[(pos - 1) / 2] < d) {
+      dists[pos] = dists[(pos - 1) / 2];
+      ids[pos] = ids[(pos - 1) / 2];
+      pos = (pos - 1) / 2;
+    }
+  } else {
+    pos = 0;                            // sostituisce la radice e scende
+    for (;;) {
+      long child = 2 * pos + 1;
+      if (child >= *size) break;
+      if (child + 1 < *size && dists[child + 1] > dists[child]) child++;
+      if (dists[child] <= d) break;
+      dists[pos] = dists[child];
+      ids[pos] = ids[child];
+      pos = child;
+    }
+  }
+  dists[pos] = d;
+  ids[pos] = id;
+}
+
+// Le k righe piu' vicine sotto bound, in ordine crescente di distanza; ritorna
+// quante ne ha trovate. Max-heap in ids/dists: la radice e' il limite da battere.
+long faceDistTopK(const float *rows, long n, long dim, const float *query, long k, float bound, long *ids, float *dists) {
+  long size = 0;
+  float d[4];
+  if (k <= 0) return 0;
+  for (long i = 0; i < n;) {
+    int got = distances(rows, i, n, dim, query, size == k ? dists[0] : bound, d);
+    for (int j = 0; j < got; j++) {
+      if (d[j] < (size == k ? dists[0] : bound)) heapPush(ids, dists, &size, k, d[j], i + j);
+    }
+    i += got;
+  }
+
+  // heap -> ordine crescente: si estrae la radice e si rimette l'ultimo
+  for (long end = size - 1; end > 0; end--) {
+    float last = dists[end];
+    long lastId = ids[end];
+    dists[end] = dists[0];
+    ids[end] = ids[0];
+    long heapSize = end;
+    dists[0] = last;                    // heapPush con heap pieno: la radice scende
+    ids[0] = lastId;
+    heapPush(ids, dists, &heapSize, heapSize, last, lastId);
+  }
+  return size;
+}
+}
@@ -0,0 +1,221 @@
+"""
+Server sostitutivo per misurare la latenza dell'ESP32-CAM senza face_recognition.
+
+Risponde a /upload (alternando 'ok' e 'not ok', con un ritardo fisso che
+simula il riconoscimento) e a /ping, in HTTP/1.1 keep-alive come app.py.
+L'ESP32 allega a ogni upload la latenza trigger -> verdetto dell'accesso
+precedente (X-Prev-Latency-Ms) e se quell'upload ha riusato la connessione
+(X-Prev-Reused): il server stampa le statistiche separate per i due casi.
+
+Risponde anche sul canale binario (porta 5001, formato di PROGETTO-CAM/protocol.h),
+dove la stessa telemetria arriva nel campo meta della richiesta.
+I riferimenti a un frame ripetuto (BIN_FLAG_REPEAT / X-Repeat) ricevono subito
+l'ultimo verdetto, senza ritardo, come in app.py.
+Il canale binario si puo' anche avviare da un altro script (start_binary_server):
+ritardo e caduta si cambiano mentre gira e ogni server conta connessioni e
+immagini ricevute (PROGETTO-CAM/host/hedge_test.py).
+
+Uso:
+    python stub_server.py --host 0.0.0.0 --port 5000 --bin-port 5001 --delay-ms 150
+Confronto: compilare lo sketch con HTTP_KEEPALIVE 1 e poi 0, eseguire una
+serie di accessi e confrontare le righe [LAT] reuse / fresh.
+"""
+import argparse
+import json
+import socketserver
+import statistics
+import struct
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+from telemetry import from_headers, log_telemetry
+
+samples = {'reuse': [], 'fresh': []}
+connections = 0
+verdicts = 0
+repeats = 0
+last_http_verdict = None
+
+BIN_REQUEST = struct.Struct('<2sBBIHBBHHI')
+BIN_REPLY = struct.Struct('<2sBBHBBHHHH')
+BIN_FLAG_REPEAT = 0x02
+
+
+def next_verdict():
+    """Alterna ok / not ok"""
+    global verdicts
+    verdicts += 1
+    return verdicts % 2 == 1
+
+
+def record_repeat(verdict):
+    global repeats
+    repeats += 1
+    print('[DEDUP] ripetuto %s (riferimenti totali: %d)' % ('ok' if verdict else 'not ok', repeats))
+
+
+def record(prev_ms, reused):
+    kind = 'reuse' if reused else 'fresh'
+    samples[kind].append(int(prev_ms))
+    print('[LAT] %s' % summary_line(kind))
+
+
+def percentile(values, p):
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(len(ordered) * p / 100))]
+
+
+class StubHandler(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def setup(self):
+        global connections
+        super().setup()
+        connections += 1
+
+    def reply(self, body, content_type='application/json', headers=None):
+        data = body.encode()
+        self.send_response(200)
+        self.send_header('Content-Type', content_type)
+        for key, value in (headers or {}).items():
+            self.send_header(key, value)
+        self.send_header('Content-Length', str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+    def do_GET(self):
+        if self.path == '/ping':
+            self.reply('ok', 'text/plain')
+        elif self.path == '/api/latency':
+            self.reply(json.dumps(summary()))
+        else:
+            self.send_error(404)
+
+    def do_POST(self):
+        global last_http_verdict
+        length = int(self.headers.get('Content-Length', 0))
+        self.rfile.read(length)
+        if self.path != '/upload':
+            self.send_error(404)
+            return
+
+        prev = self.headers.get('X-Prev-Latency-Ms')
+        if prev is not None:
+            record(prev, self.headers.get('X-Prev-Reused') == '1')
+        log_telemetry(from_headers(self.headers))
+
+        if self.headers.get('X-Repeat') == '1':
+            if last_http_verdict is None:
+                self.send_response(409)
+                self.send_header('Content-Length', '0')
+                self.end_headers()
+                return
+            record_repeat(last_http_verdict)
+            self.reply(json.dumps({'status': 'ok' if last_http_verdict else 'not ok', 'repeat': True}),
+                       headers={'X-Server-Time-Ms': '0'})
+            return
+
+        time.sleep(self.server.delay_ms / 1000.0)
+        last_http_verdict = next_verdict()
+        status = 'ok' if last_http_verdict else 'not ok'
+        self.reply(json.dumps({'status': status, 'bytes': length}),
+                   headers={'X-Server-Time-Ms': str(self.server.delay_ms)})
+
+    def log_message(self, fmt, *args):
+        pass
+
+
+class StubBinaryHandler(socketserver.BaseRequestHandler):
+    def recv_exact(self, size):
+        data = b''
+        while len(data) < size:
+            chunk = self.request.recv(size - len(data))
+            if not chunk:
+                return None
+            data += chunk
+        return data
+
+    def handle(self):
+        global connections
+        connections += 1
+        self.server.connections += 1
+        last_verdict = None
+        while True:
+            header = self.recv_exact(BIN_REQUEST.size)
+            if header is None:
+                return
+            _, _, frame_type, _, request_id, flags, _, meta_len, _, payload_len = BIN_REQUEST.unpack(header)
+            meta = self.recv_exact(meta_len) if meta_len else b''
+            if payload_len:
+                self.recv_exact(payload_len)
+            if frame_type == 0x02:
+                self.request.sendall(BIN_REPLY.pack(b'SH', 1, 0x82, 0, ord('N'), 0, 0xFFFF, 0, 0, 0))
+                continue
+            if frame_type != 0x01:
+                continue
+            self.server.images += 1
+            if self.server.drop:
+                return                  # server caduto: chiude la connessione senza rispondere
+
+            fields = dict(item.split('=', 1) for item in meta.decode().split(';') if '=' in item)
+            if 'prev_ms' in fields:
+                record(fields['prev_ms'], fields.get('reused') == '1')
+            log_telemetry(fields)
+            if flags & BIN_FLAG_REPEAT:
+                if last_verdict is not None:
+                    record_repeat(last_verdict == ord('Y'))
+                self.request.sendall(BIN_REPLY.pack(b'SH', 1, 0x81, request_id, last_verdict or ord('R'), 0,
+                                                    0xFFFF, 0, 0, 0))
+                continue
+            time.sleep(self.server.delay_ms / 1000.0)
+            verdict = last_verdict = ord('Y') if next_verdict() else ord('N')
+            self.request.sendall(BIN_REPLY.pack(b'SH', 1, 0x81, request_id, verdict, 0, 300, 0,
+                                                self.server.delay_ms, 0))
+
+
+def summary_line(kind):
+    values = samples[kind]
+    return '%-5s n=%d p50=%d ms p95=%d ms mean=%.1f ms (connessioni TCP totali: %d)' % (
+        kind, len(values), statistics.median(values), percentile(values, 95), statistics.mean(values), connections)
+
+
+def summary():
+    return {kind: {'n': len(v), 'p50': statistics.median(v), 'p95': percentile(v, 95)}
+            for kind, v in samples.items() if v}
+
+
+def start_binary_server(host, port, delay_ms):
+    """Canale binario in un thread; delay_ms e drop si possono cambiare mentre gira"""
+    socketserver.ThreadingTCPServer.allow_reuse_address = True
+    server = socketserver.ThreadingTCPServer((host, port), StubBinaryHandler)
+    server.daemon_threads = True
+    server.delay_ms = delay_ms
+    server.drop = False
+    server.connections = 0
+    server.images = 0
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    return server
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--host', default='0.0.0.0')
+    parser.add_argument('--port', type=int, default=5000)
+    parser.add_argument('--bin-port', type=int, default=5001)
+    parser.add_argument('--delay-ms', type=int, default=150, help='tempo simulato di riconoscimento')
+    args = parser.parse_args()
+
+    start_binary_server(args.host, args.bin_port, args.delay_ms)
+
+    server = ThreadingHTTPServer((args.host, args.port), StubHandler)
+    server.delay_ms = args.delay_ms
+    print('[INFO] Stub server su %s:%d (binario %d)' % (args.host, args.port, args.bin_port))
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == '__main__':
+    main()
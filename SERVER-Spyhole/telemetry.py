@@ -0,0 +1,29 @@
+"""
+Telemetria che l'ESP32-CAM allega una volta all'upload successivo (controllo
+adattivo, Wi-Fi, standby, esposizione, duplicati/failover, stadi dell'accesso
+precedente). Arriva nel campo meta del canale binario o negli header HTTP:
+app.py e stub_server.py la stampano con la stessa tabella.
+"""
+
+# campo meta del canale binario, header HTTP, tag stampato
+TELEMETRY_FIELDS = (
+    ('adapt', 'X-Adapt', 'ADAPT'),
+    ('wifi', 'X-Wifi', 'WIFI'),
+    ('power', 'X-Power', 'POWER'),
+    ('ae', 'X-AE', 'AE'),
+    ('hedge', 'X-Hedge', 'HEDGE'),
+    ('stages', 'X-Prev-Stages', 'STAGES'),
+)
+
+
+def from_headers(headers):
+    """Telemetria di un upload HTTP, con le stesse chiavi del campo meta"""
+    return {key: headers.get(header) for key, header, _ in TELEMETRY_FIELDS}
+
+
+def log_telemetry(fields, device=None):
+    """Una riga [TAG] per ogni campo presente (fields = meta o from_headers)"""
+    prefix = f"{device} " if device is not None else ''
+    for key, _, tag in TELEMETRY_FIELDS:
+        if fields.get(key):
+            print(f"[{tag}] {prefix}{fields[key]}")